@@ -99,6 +99,10 @@ impl CallGraph {
         }
     }
 
+    pub fn contains(&self, func: &str) -> bool {
+        self.node_map.contains_key(func)
+    }
+
     pub fn get_direct_callees(&self, func: &str) -> Vec<&str> {
         let node = self
             .node_map
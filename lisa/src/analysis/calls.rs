@@ -0,0 +1,81 @@
+//! Extract the call sequence of a program with a tree-sitter query.
+//! The parser and the query cursor are cached per thread, and the query is compiled once.
+use std::cell::RefCell;
+
+use once_cell::sync::OnceCell;
+use tree_sitter::{Parser, Query, QueryCursor};
+
+thread_local! {
+    static PARSER: RefCell<Parser> = RefCell::new(new_cpp_parser());
+    static QUERY_CURSOR: RefCell<QueryCursor> = RefCell::new(QueryCursor::new());
+}
+
+pub fn new_cpp_parser() -> Parser {
+    let mut parser = Parser::new();
+    parser
+        .set_language(tree_sitter_cpp::language())
+        .expect("Failed to load C++ grammar");
+    parser
+}
+
+fn get_call_query() -> &'static Query {
+    static CALL_QUERY: OnceCell<Query> = OnceCell::new();
+    CALL_QUERY.get_or_init(|| {
+        Query::new(
+            tree_sitter_cpp::language(),
+            "(call_expression function: (_) @callee)",
+        )
+        .expect("Failed to compile the call query")
+    })
+}
+
+/// Extract the callees of a program in the order of their appearance.
+/// The whitespaces inside a callee (e.g., `ctx -> free`) are removed.
+pub fn extract_api_calls(source: &str) -> Vec<String> {
+    let tree = match PARSER.with(|parser| parser.borrow_mut().parse(source, None)) {
+        Some(tree) => tree,
+        None => {
+            log::warn!("Failed to parse code for call extraction");
+            return Vec::new();
+        }
+    };
+    QUERY_CURSOR.with(|cursor| {
+        cursor
+            .borrow_mut()
+            .captures(get_call_query(), tree.root_node(), source.as_bytes())
+            .filter_map(|(m, i)| m.captures[i].node.utf8_text(source.as_bytes()).ok())
+            .map(|callee| callee.split_whitespace().collect::<String>())
+            .collect()
+    })
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_extract_api_calls() {
+        let source = r#"
+        int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+            cJSON *json = cJSON_ParseWithLength((const char *)data, size);
+            char *out = cJSON_Print(cJSON_GetObjectItem(json, "key"));
+            ctx -> free(out);
+            cJSON_Delete(json);
+            return 0;
+        }
+        "#;
+        let calls = extract_api_calls(source);
+        assert_eq!(
+            calls,
+            vec![
+                "cJSON_ParseWithLength",
+                "cJSON_Print",
+                "cJSON_GetObjectItem",
+                "ctx->free",
+                "cJSON_Delete"
+            ]
+        );
+        // the cached parser is reused by the following parses.
+        assert_eq!(extract_api_calls(source), calls);
+    }
+}
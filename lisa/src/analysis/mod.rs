@@ -2,6 +2,7 @@ use std::collections::VecDeque;
 
 pub mod adg;
 pub mod callgraph;
+pub mod calls;
 pub mod cfg;
 pub mod dfa;
 pub mod fdsan;
@@ -6,6 +6,8 @@ use crate::feedback::clang_coverage::CodeCoverage;
 use csv::Writer;
 use eyre::{Result, eyre, Error};
 use serde::{Serialize, Serializer, Deserialize, Deserializer};
+use std::collections::HashMap;
+use std::ffi::OsString;
 use std::option::Option;
 use std::path::{PathBuf, Path};
 use std::time::{Duration, Instant};
@@ -47,6 +49,9 @@ struct SeedMeta {
     #[serde(deserialize_with = "seconds_as_duration")]
     duration_since_start: Duration,
     pub cumulative_branch_coverage: Option<f32>,
+    /// The call sequence extracted at generation, separated by spaces.
+    #[serde(default)]
+    pub api_calls: String,
 }
 
 impl SeedMetas {
@@ -58,7 +63,7 @@ impl SeedMetas {
     }
 
     /// Add a generated seed's meta data
-    pub fn add(&mut self, seed_path: &Path, generation_time: Instant, branch_coverage: Option<f32>) -> Result<()> {
+    pub fn add(&mut self, seed_path: &Path, generation_time: Instant, branch_coverage: Option<f32>, api_calls: &[String]) -> Result<()> {
         if self.start_time.is_none() {
             return Err(eyre!("To add new seeds with this method, SeedMetas must be initialized with a start time"));
         }
@@ -67,6 +72,7 @@ impl SeedMetas {
                 seed_path: seed_path.to_path_buf(),
                 duration_since_start: generation_time - self.start_time.unwrap(),
                 cumulative_branch_coverage: branch_coverage,
+                api_calls: api_calls.join(" "),
             }
         );
         Ok(())
@@ -76,6 +82,21 @@ impl SeedMetas {
         self.seed_metas.len()
     }
 
+    /// The call sequences of seeds keyed by their file names, thus the seeds need not be parsed again.
+    pub fn get_api_calls(&self) -> HashMap<OsString, Vec<String>> {
+        self.seed_metas
+            .iter()
+            .filter_map(|meta| {
+                let calls = meta
+                    .api_calls
+                    .split_whitespace()
+                    .map(|x| x.to_string())
+                    .collect();
+                meta.seed_path.file_name().map(|name| (name.to_os_string(), calls))
+            })
+            .collect()
+    }
+
     /// Write seed metadata to path
     pub fn write_to(&self, path: &Path) -> Result<()> {
         let mut writer =  Writer::from_path(path)?;
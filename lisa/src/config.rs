@@ -35,11 +35,14 @@ pub const EXECUTION_TIMEOUT: u64 = 180;
 
 pub const SANITIZATION_TIMEOUT: u64 = 1200;
 
-pub const MIN_FUZZ_TIME: u64 = 60;
-
 pub const MAX_FUZZ_TIME: u64 = 600;
 
-pub const MAX_CONTEXT_APIS: usize = 100;
+/// The budget of the API signatures listed in the context of prompts, in bytes. The context is
+/// served from the prefix cache, so it is sized to hold the APIs of most libraries in whole.
+pub const MAX_CONTEXT_API_BYTES: usize = 32 * 1024;
+
+// The capacity of the compiled binary cache in bytes.
+pub const COMPILE_CACHE_SIZE: u64 = 20 * 1024 * 1024 * 1024;
 // recover the report of UBSan, or we can use UBSAN_OPTIONS=symbolize=1:print_stacktrace=1:halt_on_error=1 instead.
 pub const SANITIZER_FLAGS: [&str; 7] = [
     "-fsanitize=fuzzer",
@@ -233,6 +236,42 @@ pub struct Config {
     /// Enable Chain of Thought (CoT) mode for API combination generation. In CoT mode, LLM first generates an execution plan in natural language, then generates code based on that plan. This can improve correctness for complex libraries.
     #[arg(long = "cot", default_value = "false")]
     pub enable_cot: bool,
+    /// The sliding window in seconds over which the fuzzer's rate of new features is measured in sanitization.
+    #[arg(long, default_value = "10")]
+    pub fuzz_window: u64,
+    /// The fuzzer in sanitization is stopped once its rate of new features (per second) over the window drops below this.
+    #[arg(long, default_value = "0.1")]
+    pub fuzz_converge_rate: f32,
+    /// The number of concurrent generation lanes in ApiCombination mode, each with its own prompt in flight.
+    #[arg(long, default_value = "1")]
+    pub api_lanes: usize,
+    /// The length of API n-grams counted as the feedback of ApiCombination mode, 2, 3 or 4.
+    #[arg(long, default_value = "3")]
+    pub api_ngram: usize,
+    /// The maximum of LLM requests in flight across all generation lanes.
+    #[arg(long, default_value = "16")]
+    pub llm_concurrency: usize,
+    /// Stream the completions of the http handler, and cancel the ones rejected before they finish.
+    #[arg(long, default_value = "false")]
+    pub stream_completions: bool,
+    /// Save the completions of all LLM requests into the response cache.
+    #[arg(long, default_value = "false")]
+    pub record: bool,
+    /// Serve all LLM requests from the response cache without any network access.
+    #[arg(long, default_value = "false", conflicts_with = "record")]
+    pub replay: bool,
+    /// The directory of the response cache, by default `llm_cache` in the output dir of the library.
+    #[arg(long)]
+    pub llm_cache_dir: Option<std::path::PathBuf>,
+    /// The seed of the random choices, random if not set. A recording keeps its seed in the response cache, which `--replay` always reuses.
+    #[arg(long)]
+    pub seed: Option<u64>,
+    /// Size the samples and the temperature of each request from the recent success and novelty rates of its APIs in ApiCombination mode.
+    #[arg(long, default_value = "false")]
+    pub adaptive_sampling: bool,
+    /// The maximum of output tokens per request of adaptive sampling, 0 for no limit.
+    #[arg(long, default_value = "0")]
+    pub round_token_budget: usize,
 }
 
 impl Config {
@@ -255,6 +294,18 @@ impl Config {
             quiet_round: 3,
             num_new_pairs: 3,
             enable_cot: false,
+            fuzz_window: 10,
+            fuzz_converge_rate: 0.1,
+            api_lanes: 1,
+            api_ngram: 3,
+            llm_concurrency: 16,
+            stream_completions: false,
+            record: false,
+            replay: false,
+            llm_cache_dir: None,
+            seed: None,
+            adaptive_sampling: false,
+            round_token_budget: 0,
         };
         let _ = CONFIG_INSTANCE.set(RwLock::new(config));
         crate::init_debug_logger().unwrap();
@@ -330,6 +381,14 @@ Here are the custom types declared in {project}. Ensure that the variables you u
 {context}
 ----------------------
 ";
+
+/// Template of the library specific rules, which is appended to the system context.
+pub const SYSTEM_RULES_TEMPLATE: &str = "
+Here are the specific rules of {project}. The code you generate must follow these rules:
+----------------------
+{project_rules}
+----------------------
+";
 pub const ERROR_REPAIR_TEMPLATE: &str =
 "The previous attempt to generate code failed with the following error:
 
@@ -341,29 +400,12 @@ If error type is execution error without error details, you can regard it as Seg
 Do not include if branches or loops; the function should be a straight-line sequence of API calls.
 ";
 
+/// The combination and the examples are placed at the end, as the text before them is the
+/// same across requests and can be served from the prefix cache.
 pub const USER_API_TEMPLATE: &str = "Your task is to write a complete, logically correct C++ function named `int test_{project}_api_sequence()` using the {project} library.
 
-The API sequence should focus on the usage of the {project} library, and several essential aspects of the library are provided below.
-
-Here are the system headers included in {project}. You can utilize the public elements of these headers:
-----------------------
-{headers}
-----------------------
-
-Here are the APIs exported from {project}. You are encouraged to use any of the following APIs once you need to create, initialize or destroy variables:
-----------------------
-{APIs}
-----------------------
-
-Here are the custom types declared in {project}. Ensure that the variables you use do not violate declarations:
-----------------------
-{context}
-----------------------
+The API sequence should focus on the usage of the {project} library, whose headers, APIs, custom types and specific rules are provided in the context.
 
-Use the following APIs in your function:
-{combinations}
-Here are some successful examples:
-{successful_examples}
 Function Requirements:
 1. The function must return `66` on success.  
 2. Do not include if branches or loops; the function should be a straight-line sequence of API calls.
@@ -372,9 +414,7 @@ Function Requirements:
 5. The function must end with:
    API sequence test completed successfully
 6. When you enter a new phase, use `// step ...` to indicate the phase. different operations are in different steps, steps cannot exceed 4
-
-Below is project's specific rules:
-{project_rules}
+7. Follow the specific rules of {project} provided in the context.
 
 Code Quality Rules:
 - The function must be self-contained: declare, initialize, and clean up all variables and resources.
@@ -399,7 +439,11 @@ int test_{project}_api_sequence() {
     // step ... : Cleanup
     return 66;
 }
-```";
+```
+
+Use the following APIs in your function:
+{combinations}
+{successful_examples}";
 
 pub const USER_GEN_TEMPLATE: &str = "Create a C language program step by step by using {project} library APIs and following the instructions below:
 1. Here are several APIs in {project}. Specific an event that those APIs could achieve together, if the input is a byte stream of {project}' output data.
@@ -415,10 +459,6 @@ pub const USER_GEN_TEMPLATE: &str = "Create a C language program step by step by
 
 /// Chain of Thought - Phase 1: Generate execution plan in natural language
 pub const USER_API_COT_PLAN_TEMPLATE: &str = "
-
-Use the following APIs in your plan:
-{combinations}
-
 **IMPORTANT: Do NOT write code in this step. Only write a detailed natural language execution plan.**
 
 Please create a detailed execution plan (in natural language, not code) for generating a C function `int test_{project}_api_sequence()` that uses the above APIs.
@@ -455,14 +495,14 @@ Write a natural language description explaining:
 
 **Do NOT write actual C/C++ code, type definitions, or function prototypes. Only write the execution plan in natural language.**
 
+Use the following APIs in your plan:
+{combinations}
 ";
 
 /// Chain of Thought - Phase 2: Generate code based on the execution plan
 pub const USER_API_COT_CODE_TEMPLATE: &str = "
 Based on the following execution plan, write a complete, logically correct C++ function named `int test_{project}_api_sequence()`.
 Do not include if branches or loops; the function should be a straight-line sequence of API calls. Return 66 on success.
-Execution Plan:
-{execution_plan}
 
 CRITICAL CODE GENERATION RULES:
 1. DO NOT declare or redefine any types, structs, or typedefs - All types are already defined in the included library headers
@@ -477,11 +517,7 @@ Your code should ONLY contain:
 - API calls
 - Return statement
 
-Below is project's specific rules, the code you generate must follow these rules:
-{project_rules}
-
-Here are some successful examples for reference:
-{successful_examples}
+The code you generate must follow the specific rules of {project} provided in the context.
 
 Again do not include if branches or loops; the function should be a straight-line sequence of API calls.
 code example outline:
@@ -495,7 +531,10 @@ int test_{project}_api_sequence() {{
 }}
 
 Remember: DO NOT declare types, use extern blocks, or redeclare functions. Only write the function body.
-";
+
+Execution Plan:
+{execution_plan}
+{successful_examples}";
 
 pub fn get_project_rules() -> String {
     let library_name = get_library_name();
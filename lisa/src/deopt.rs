@@ -527,6 +527,20 @@ impl Deopt {
         Ok(coverage)
     }
 
+    /// Obtain the coverage of seeds concurrently, and the results are in the order of `seed_ids`.
+    /// The executor is passed by the callers, which iterate the seeds in chunks.
+    pub fn get_seeds_coverage(
+        &self,
+        executor: &Executor,
+        seed_ids: &[usize],
+    ) -> Result<Vec<CodeCoverage>> {
+        let mut profdatas = Vec::new();
+        for seed_id in seed_ids {
+            profdatas.push(self.get_seed_coverage_file(*seed_id)?);
+        }
+        executor.obtain_covs_from_profdatas(&profdatas)
+    }
+
     // Save the seed programs into disk.
     pub fn save_program(&self, program: &Program) -> Result<PathBuf> {
         let seed_path = self.get_seed_path_by_id(program.id)?;
@@ -643,6 +657,43 @@ pub mod utils {
         Ok(())
     }
 
+    /// A 128-bit FNV-1a digest. Unlike `DefaultHasher`, its output is fixed across runs and
+    /// toolchains, so it can name the entries of the caches persisted in the output directory.
+    pub struct StableHasher(u128);
+
+    impl Default for StableHasher {
+        fn default() -> Self {
+            Self::new()
+        }
+    }
+
+    impl StableHasher {
+        const OFFSET_BASIS: u128 = 0x6c62272e07bb014262b821756295c58d;
+        const PRIME: u128 = 0x0000000001000000000000000000013b;
+
+        pub fn new() -> Self {
+            Self(Self::OFFSET_BASIS)
+        }
+
+        /// Feed a field prefixed by its length, so the boundaries of the fields are unambiguous.
+        pub fn write(&mut self, bytes: &[u8]) {
+            self.write_raw(&(bytes.len() as u64).to_le_bytes());
+            self.write_raw(bytes);
+        }
+
+        fn write_raw(&mut self, bytes: &[u8]) {
+            for byte in bytes {
+                self.0 ^= *byte as u128;
+                self.0 = self.0.wrapping_mul(Self::PRIME);
+            }
+        }
+
+        /// The digest as 32 hex digits.
+        pub fn finish_hex(&self) -> String {
+            format!("{:032x}", self.0)
+        }
+    }
+
     /// read the directory and sort the entries by the alphabet oder
     pub fn read_sort_dir(dir: &Path) -> Result<Vec<PathBuf>> {
         let mut entries = Vec::new();
@@ -874,4 +925,12 @@ mod tests {
         deopt.update_seed_unique_branches(&coverage);
         Ok(())
     }
+
+    #[test]
+    fn test_stable_hasher() {
+        let mut hasher = utils::StableHasher::new();
+        hasher.write(b"lisa");
+        hasher.write(b"");
+        assert_eq!(hasher.finish_hex(), "592d5d470b87a52a8e7e2932eccfc206");
+    }
 }
@@ -3,10 +3,12 @@
 //!     $ clang++ -Xclang -ast-dump=json -fsyntax-only path/to/source.cc
 
 use crate::ast::loc::get_source_code_range;
+use crate::deopt::utils::StableHasher;
 use crate::program::gadget::get_func_gadget;
 use crate::Deopt;
 use clang_ast::SourceLocation;
 use eyre::{Context, Result};
+use std::io::{BufRead, BufReader};
 use std::path::{Path, PathBuf};
 use std::process::{Command, Stdio};
 
@@ -41,6 +43,12 @@ impl Executor {
             .arg(include_path)
             .arg(program);
 
+        // use the pch of the program's own includes unless the caller passes its owns.
+        let pch_list = if pch_list.is_empty() {
+            get_ast_pch(program, deopt, use_fdp).into_iter().collect()
+        } else {
+            pch_list
+        };
         for pch in pch_list {
             cmd = cmd.arg("-include-pch").arg(pch);
         }
@@ -52,19 +60,28 @@ impl Executor {
 
         //log::trace!("extract ast from {program:?}, cmd: {cmd:?}");
 
-        let output = cmd
+        // stream the dumped asts, and stop clang once the target function is found.
+        let mut child = cmd
             .stdout(Stdio::piped())
-            .output()
+            .stderr(Stdio::piped())
+            .spawn()
             .expect("failed to execute cmd.");
-        if output.status.success() {
-            let json_output = output.stdout.as_slice();
-            let node: Node = ast_dump_filter(json_output, func)?;
+        let stderr = child.stderr.take().unwrap();
+        let stderr_reader = std::thread::spawn(move || super::get_child_err(stderr));
+        let stdout = BufReader::new(child.stdout.take().unwrap());
+        let res = ast_dump_filter(stdout, func);
+        if let Ok(Some(node)) = res {
+            let _ = child.kill();
+            child.wait()?;
             return Ok(node);
         }
-        eyre::bail!(
-            "fail to extract from {program:?}\n, {}",
-            String::from_utf8_lossy(&output.stderr)
-        );
+        let status = child.wait()?;
+        let err_msg = stderr_reader.join().unwrap_or_default();
+        res?;
+        if status.success() {
+            eyre::bail!("fail to find {func} in the ast of {program:?}");
+        }
+        eyre::bail!("fail to extract from {program:?}\n, {err_msg}");
     }
 
     pub fn extract_program_ast(program: &Path) -> Result<Node> {
@@ -91,6 +108,9 @@ impl Executor {
         Ok(ast)
     }
 
+    /// The json dump is deserialized straight from the pipe while stderr is drained by another
+    /// thread, so the dump of all included headers, which is much larger than the parsed `Node`,
+    /// is never held in memory. The large buffer keeps `from_reader` off the per-byte reads.
     pub fn extract_header_ast(header: &Path, deopt: &Deopt) -> Result<Node> {
         let include_path =
             "-I".to_owned() + deopt.get_library_build_header_path()?.to_str().unwrap();
@@ -103,43 +123,133 @@ impl Executor {
             .arg("-ast-dump=json")
             .arg(include_path)
             .arg(header);
-        let output = binding
+        let mut child = binding
             .stdout(Stdio::piped())
-            .output()
+            .stderr(Stdio::piped())
+            .spawn()
             .expect("failed to execute cmd.");
-        if output.status.success() {
-            let json_output = output.stdout.as_slice();
-            let node: Node = serde_json::from_slice(json_output)
-                .with_context(|| eyre::eyre!("fail to extract ast from {header:?}"))?;
+        let stderr = child.stderr.take().unwrap();
+        let stderr_reader = std::thread::spawn(move || super::get_child_err(stderr));
+        let stdout = BufReader::with_capacity(1 << 20, child.stdout.take().unwrap());
+        // a failed parse drops the pipe, so clang stops on its next write.
+        let res: serde_json::Result<Node> = serde_json::from_reader(stdout);
+        let status = child.wait()?;
+        let err_msg = stderr_reader.join().unwrap_or_default();
+        if status.success() {
+            let node = res.with_context(|| eyre::eyre!("fail to extract ast from {header:?}"))?;
             return Ok(node);
         }
-        eyre::bail!(
-            "fail to extract ast from {header:?}\n cmd:{binding:?}\n {}",
-            String::from_utf8_lossy(&output.stderr)
-        );
+        eyre::bail!("fail to extract ast from {header:?}\n cmd:{binding:?}\n {err_msg}");
     }
 }
 
+/// Get the pch of the include prefix of `program` used in AST extraction, see `get_prefix_pch`.
+/// The pch is tagged by the fingerprint of the header directory, which is taken on every call,
+/// so a rebuilt library gets fresh pchs. The pchs of stale headers are left in place, as other
+/// processes may still use them.
+pub fn get_ast_pch(program: &Path, deopt: &Deopt, use_fdp: bool) -> Option<PathBuf> {
+    let header_dir = deopt.get_library_build_header_path().ok()?;
+    let fingerprint = match get_header_fingerprint(&header_dir) {
+        Ok(fingerprint) => fingerprint,
+        Err(err) => {
+            log::warn!("fail to fingerprint the headers in {header_dir:?}: {err}");
+            return None;
+        }
+    };
+    let fdp = if use_fdp { "fdp" } else { "nofdp" };
+    let tag = format!("ast.{fingerprint}.{fdp}");
+    super::get_prefix_pch(program, &tag, |name, prefix| {
+        build_ast_pch(deopt, &header_dir, use_fdp, name, prefix)
+    })
+}
+
+fn build_ast_pch(
+    deopt: &Deopt,
+    header_dir: &Path,
+    use_fdp: bool,
+    name: &str,
+    prefix: &str,
+) -> Result<Option<PathBuf>> {
+    let pch_dir: PathBuf = [deopt.get_library_misc_dir()?, "pch".into()]
+        .iter()
+        .collect();
+    crate::deopt::utils::create_dir_if_nonexist(&pch_dir)?;
+    let pch: PathBuf = [pch_dir, format!("{name}.h.pch").into()].iter().collect();
+    if pch.exists() {
+        return Ok(Some(pch));
+    }
+    // the same include flags as the extraction, so the pch is accepted by it.
+    let mut args = vec!["-I".to_owned() + header_dir.to_str().unwrap()];
+    if use_fdp {
+        args.push("-I".to_owned() + Deopt::get_fdp_path()?.to_str().unwrap());
+    }
+    if !super::precompile_headers(deopt, &pch, prefix, &args, false)? {
+        return Ok(None);
+    }
+    log::debug!("build the pch for ast extraction: {pch:?}");
+    Ok(Some(pch))
+}
+
+/// Hash the paths, sizes and modified times of all headers in `header_dir`.
+fn get_header_fingerprint(header_dir: &Path) -> Result<String> {
+    let mut headers = crate::deopt::utils::read_all_files_in_dir(header_dir)?;
+    headers.sort();
+    let mut hasher = StableHasher::new();
+    for header in headers {
+        let metadata = std::fs::metadata(&header)?;
+        let modified = metadata.modified()?.duration_since(std::time::UNIX_EPOCH)?;
+        hasher.write(header.to_string_lossy().as_bytes());
+        hasher.write(&metadata.len().to_le_bytes());
+        hasher.write(&modified.as_nanos().to_le_bytes());
+    }
+    Ok(hasher.finish_hex())
+}
+
+/// The value of the top-level string `field` of a dumped decl on `line`. Clang pretty-prints the
+/// dump with two-space indents, so the fields of nested objects are never matched.
+fn get_top_level_field<'a>(line: &'a [u8], field: &str) -> Option<&'a [u8]> {
+    let rest = line.strip_prefix(b"  \"")?;
+    let rest = rest.strip_prefix(field.as_bytes())?;
+    let rest = rest.strip_prefix(b"\": \"")?;
+    let end = rest.iter().position(|byte| *byte == b'"')?;
+    Some(&rest[..end])
+}
+
 /// Filter the ast and only retain the node with function name as `func`.
-fn ast_dump_filter(data: &[u8], func: &str) -> Result<Node> {
-    let it = data.iter();
+/// Clang dumps each matched decl as a standalone json document closed by a `}` at the line start.
+/// The kind and name of each document are scanned from its raw lines, and only the target one
+/// is deserialized into `Node`.
+fn ast_dump_filter<R: BufRead>(mut reader: R, func: &str) -> Result<Option<Node>> {
     let mut json: Vec<u8> = Vec::new();
-    let mut last: u8 = 0_u8;
-    for cur in it {
-        json.push(*cur);
-        if *cur == b'}' && last == b'\n' {
+    let mut line: Vec<u8> = Vec::new();
+    let mut is_func = false;
+    let mut is_target = false;
+    loop {
+        line.clear();
+        if reader.read_until(b'\n', &mut line)? == 0 {
+            return Ok(None);
+        }
+        json.extend_from_slice(&line);
+        if let Some(kind) = get_top_level_field(&line, "kind") {
+            is_func = kind == b"FunctionDecl";
+        } else if let Some(name) = get_top_level_field(&line, "name") {
+            is_target = name == func.as_bytes();
+        }
+        if !line.starts_with(b"}") {
+            continue;
+        }
+        if is_func && is_target {
             let ast: Node = serde_json::from_slice(json.as_slice())?;
             if let Clang::FunctionDecl(fd) = &ast.kind {
-                let name = fd.get_name();
-                if func == name {
-                    return Ok(ast);
+                if func == fd.get_name() {
+                    return Ok(Some(ast));
                 }
             }
-            json.clear();
         }
-        last = *cur;
+        json.clear();
+        is_func = false;
+        is_target = false;
     }
-    unreachable!()
 }
 
 /// elimitate the irrelative asts that included in this file.
@@ -230,7 +340,8 @@ fn test_ast_dump_filter() -> Result<()> {
     //log::trace!("extract ast from {program:?}, cmd: {cmd:?}");
     if output.status.success() {
         let json_output = output.stdout.as_slice();
-        let node = ast_dump_filter(json_output, func)?;
+        let node = ast_dump_filter(json_output, func)?
+            .ok_or_else(|| eyre::eyre!("Unable to find {func} in the ast"))?;
         if let Clang::FunctionDecl(fd) = &node.kind {
             assert_eq!(func, &fd.get_name());
             return Ok(());
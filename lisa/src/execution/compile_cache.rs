@@ -0,0 +1,276 @@
+//! A content-addressed store of compiled binaries, shared by all `Compile` kinds.
+//! The key covers the sources, the compile flags, the linked library and the clang version,
+//! so re-running on an existing output directory does not recompile the unchanged seeds.
+use crate::{deopt::utils::StableHasher, Deopt};
+use eyre::Result;
+use once_cell::sync::OnceCell;
+use std::{
+    collections::{HashMap, HashSet},
+    path::{Path, PathBuf},
+    process::Command,
+    sync::{
+        atomic::{AtomicUsize, Ordering},
+        Mutex,
+    },
+    time::SystemTime,
+};
+
+static CACHE_HITS: AtomicUsize = AtomicUsize::new(0);
+static CACHE_MISSES: AtomicUsize = AtomicUsize::new(0);
+static CACHE_INSERTS: AtomicUsize = AtomicUsize::new(0);
+
+/// Check the store size and evict the least recently used entries per this number of inserts.
+const EVICT_INTERVAL: usize = 64;
+
+fn get_clang_version() -> &'static str {
+    static CLANG_VERSION: OnceCell<String> = OnceCell::new();
+    CLANG_VERSION.get_or_init(|| {
+        let output = Command::new("clang++")
+            .arg("--version")
+            .output()
+            .expect("failed to execute the clang version process.");
+        String::from_utf8_lossy(&output.stdout).to_string()
+    })
+}
+
+/// The content hash of the library, which is computed once unless the library is rebuilt.
+fn get_library_hash(lib: &Path) -> Result<String> {
+    static LIB_HASHES: OnceCell<Mutex<HashMap<(PathBuf, u64, SystemTime), String>>> =
+        OnceCell::new();
+    let metadata = std::fs::metadata(lib)?;
+    let key = (lib.to_path_buf(), metadata.len(), metadata.modified()?);
+    let hashes = LIB_HASHES.get_or_init(|| Mutex::new(HashMap::new()));
+    if let Some(hash) = hashes.lock().unwrap().get(&key) {
+        return Ok(hash.clone());
+    }
+    let mut hasher = StableHasher::new();
+    hasher.write(&std::fs::read(lib)?);
+    let hash = hasher.finish_hex();
+    hashes.lock().unwrap().insert(key, hash.clone());
+    Ok(hash)
+}
+
+/// Hash the files included by quotes from `source`, recursively, relative to the includer.
+fn hash_local_includes(
+    source: &Path,
+    content: &[u8],
+    visited: &mut HashSet<PathBuf>,
+    hasher: &mut StableHasher,
+) -> Result<()> {
+    let dir = source.parent().unwrap_or(Path::new("."));
+    for line in String::from_utf8_lossy(content).lines() {
+        let Some(name) = super::get_quoted_include(line) else {
+            continue;
+        };
+        let include = dir.join(name);
+        // the files not found here are searched in the include paths, that is, the library
+        // headers and the FDP header.
+        if !include.is_file() || !visited.insert(include.clone()) {
+            continue;
+        }
+        let include_content = std::fs::read(&include)?;
+        hasher.write(include.to_string_lossy().as_bytes());
+        hasher.write(&include_content);
+        hash_local_includes(&include, &include_content, visited, hasher)?;
+    }
+    Ok(())
+}
+
+fn get_cache_dir(deopt: &Deopt) -> Result<PathBuf> {
+    let cache_dir: PathBuf = [deopt.get_library_output_dir()?, "compile_cache".into()]
+        .iter()
+        .collect();
+    crate::deopt::utils::create_dir_if_nonexist(&cache_dir)?;
+    Ok(cache_dir)
+}
+
+/// Compute the cache key of a compilation. The library headers are covered by the library hash,
+/// as they are installed by the same library build, and the FDP header and the local includes
+/// of the sources are hashed by content. The source paths are part of the key because the debug
+/// info and the coverage mapping record them. System headers are covered by the clang version
+/// only, so upgrading the libc or libstdc++ in place requires clearing the store.
+pub fn compute_key(
+    programs: &[&Path],
+    cflags: &[&str],
+    lib: &Path,
+    header_cmd: &str,
+    deopt: &Deopt,
+) -> Result<String> {
+    let mut hasher = StableHasher::new();
+    let mut visited = HashSet::new();
+    for program in programs {
+        let content = std::fs::read(program)?;
+        hasher.write(program.to_string_lossy().as_bytes());
+        hasher.write(&content);
+        hash_local_includes(program, &content, &mut visited, &mut hasher)?;
+    }
+    for flag in cflags {
+        hasher.write(flag.as_bytes());
+    }
+    hasher.write(header_cmd.as_bytes());
+    for flag in deopt.config.extra_c_flags.iter().flatten() {
+        hasher.write(flag.as_bytes());
+    }
+    hasher.write(lib.to_string_lossy().as_bytes());
+    hasher.write(get_library_hash(lib)?.as_bytes());
+    hasher.write(&get_fdp_header()?);
+    hasher.write(get_clang_version().as_bytes());
+    Ok(hasher.finish_hex())
+}
+
+fn get_fdp_header() -> Result<&'static Vec<u8>> {
+    static FDP_HEADER: OnceCell<Vec<u8>> = OnceCell::new();
+    FDP_HEADER.get_or_try_init(|| {
+        let header: PathBuf = [Deopt::get_fdp_path()?, "FuzzedDataProvider.h".into()]
+            .iter()
+            .collect();
+        Ok(std::fs::read(header)?)
+    })
+}
+
+fn get_entry_path(cache_dir: &Path, key: &str) -> PathBuf {
+    cache_dir.join(format!("{key}.out"))
+}
+
+/// The sidecar of an entry, whose mtime records the last use of the entry. The entry itself
+/// is hard linked to the outputs, so touching it would change the mtime of the outputs too.
+fn get_used_path(cache_dir: &Path, key: &str) -> PathBuf {
+    cache_dir.join(format!("{key}.used"))
+}
+
+fn touch(path: &Path) -> Result<()> {
+    let file = std::fs::File::options()
+        .create(true)
+        .truncate(false)
+        .write(true)
+        .open(path)?;
+    file.set_modified(SystemTime::now())?;
+    Ok(())
+}
+
+/// Link the cached binary of `key` to `out`. Return false if there is no such entry.
+pub fn fetch(deopt: &Deopt, key: &str, out: &Path) -> Result<bool> {
+    let cache_dir = get_cache_dir(deopt)?;
+    let entry = get_entry_path(&cache_dir, key);
+    if !entry.exists() {
+        CACHE_MISSES.fetch_add(1, Ordering::Relaxed);
+        return Ok(false);
+    }
+    if out.exists() {
+        std::fs::remove_file(out)?;
+    }
+    // the entry could be evicted by other threads at the meantime.
+    if std::fs::hard_link(&entry, out).is_err() && std::fs::copy(&entry, out).is_err() {
+        CACHE_MISSES.fetch_add(1, Ordering::Relaxed);
+        return Ok(false);
+    }
+    // refresh the recency of LRU.
+    let _ = touch(&get_used_path(&cache_dir, key));
+    CACHE_HITS.fetch_add(1, Ordering::Relaxed);
+    log::trace!("compile cache hit: {out:?}");
+    Ok(true)
+}
+
+/// Save the compiled binary `out` as the entry of `key`.
+pub fn store(deopt: &Deopt, key: &str, out: &Path) -> Result<()> {
+    let cache_dir = get_cache_dir(deopt)?;
+    let entry = get_entry_path(&cache_dir, key);
+    // the same key could be stored by other threads or processes at the meantime, and the
+    // entries are identical, so the first one wins.
+    match std::fs::hard_link(out, &entry) {
+        Ok(()) => {}
+        Err(err) if err.kind() == std::io::ErrorKind::AlreadyExists => return Ok(()),
+        Err(_) => {
+            // copy aside and rename, so readers never see a partially written entry.
+            static TEMP_ID: AtomicUsize = AtomicUsize::new(0);
+            let temp = cache_dir.join(format!(
+                "{key}.{}.{}.tmp",
+                std::process::id(),
+                TEMP_ID.fetch_add(1, Ordering::Relaxed)
+            ));
+            if let Err(err) = std::fs::copy(out, &temp) {
+                let _ = std::fs::remove_file(&temp);
+                return Err(err.into());
+            }
+            std::fs::rename(&temp, &entry)?;
+        }
+    }
+    touch(&get_used_path(&cache_dir, key))?;
+    if CACHE_INSERTS.fetch_add(1, Ordering::Relaxed) % EVICT_INTERVAL == EVICT_INTERVAL - 1 {
+        evict(&cache_dir, crate::config::COMPILE_CACHE_SIZE)?;
+    }
+    Ok(())
+}
+
+/// Remove the least recently used entries until the store fits in `capacity` bytes.
+/// The recency of an entry is the later mtime of the entry and of its sidecar.
+fn evict(cache_dir: &Path, capacity: u64) -> Result<()> {
+    let mut entries = Vec::new();
+    let mut total_size = 0;
+    for entry in std::fs::read_dir(cache_dir)? {
+        let path = entry?.path();
+        if path.extension().map_or(true, |ext| ext != "out") {
+            continue;
+        }
+        // the entry could be removed by other threads at the meantime.
+        let Ok(metadata) = std::fs::metadata(&path) else {
+            continue;
+        };
+        let used = path.with_extension("used");
+        let mut recency = metadata.modified()?;
+        if let Ok(used_time) = std::fs::metadata(&used).and_then(|meta| meta.modified()) {
+            recency = recency.max(used_time);
+        }
+        total_size += metadata.len();
+        entries.push((recency, metadata.len(), path, used));
+    }
+    if total_size <= capacity {
+        return Ok(());
+    }
+    entries.sort();
+    for (_, size, path, used) in entries {
+        if total_size <= capacity {
+            break;
+        }
+        if std::fs::remove_file(&path).is_ok() {
+            let _ = std::fs::remove_file(&used);
+            total_size -= size;
+        }
+    }
+    log::debug!("evict compile cache to {total_size} bytes");
+    Ok(())
+}
+
+pub fn log_cache_stats() {
+    let hits = CACHE_HITS.load(Ordering::Relaxed);
+    let misses = CACHE_MISSES.load(Ordering::Relaxed);
+    log::info!("Compile cache: {hits} hits, {misses} misses");
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_compile_cache_eviction() -> Result<()> {
+        let cache_dir = std::env::temp_dir().join("lisa_compile_cache_test");
+        if cache_dir.exists() {
+            std::fs::remove_dir_all(&cache_dir)?;
+        }
+        std::fs::create_dir_all(&cache_dir)?;
+        for i in 0..4 {
+            std::fs::write(get_entry_path(&cache_dir, &i.to_string()), [0_u8; 16])?;
+            std::thread::sleep(std::time::Duration::from_millis(10));
+        }
+        // using the oldest entry keeps it.
+        touch(&get_used_path(&cache_dir, "0"))?;
+        evict(&cache_dir, 32)?;
+        assert!(cache_dir.join("0.out").exists());
+        assert!(cache_dir.join("0.used").exists());
+        assert!(!cache_dir.join("1.out").exists());
+        assert!(!cache_dir.join("2.out").exists());
+        assert!(cache_dir.join("3.out").exists());
+        std::fs::remove_dir_all(&cache_dir)?;
+        Ok(())
+    }
+}
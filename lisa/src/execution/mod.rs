@@ -1,4 +1,5 @@
 pub mod ast;
+pub mod compile_cache;
 pub mod logger;
 pub mod sanitize;
 
@@ -14,18 +15,20 @@ use crate::{
     Deopt,
 };
 use eyre::Result;
+use once_cell::sync::OnceCell;
 use regex::Regex;
+use std::collections::{HashMap, VecDeque};
 use std::ffi::OsString;
 use std::process::ChildStderr;
 use std::sync::{
-    atomic::{AtomicBool, Ordering},
+    atomic::{AtomicBool, AtomicUsize, Ordering},
     mpsc::channel,
-    Arc,
+    Arc, Condvar, Mutex,
 };
 use std::{
     ffi::OsStr,
     fmt::Debug,
-    io::Read,
+    io::{BufRead, Read, Write},
     path::{Path, PathBuf},
     process::{Child, Command, Stdio},
     time::Duration,
@@ -43,6 +46,47 @@ pub enum Compile {
     Normal,
 }
 
+/// A counting semaphore of concurrent jobs.
+pub struct Slots {
+    free: Mutex<usize>,
+    released: Condvar,
+}
+
+/// A taken slot, which is given back on drop.
+pub struct Slot<'a>(&'a Slots);
+
+impl Slots {
+    pub fn new(slots: usize) -> Self {
+        Self {
+            free: Mutex::new(slots.max(1)),
+            released: Condvar::new(),
+        }
+    }
+
+    pub fn acquire(&self) -> Slot<'_> {
+        let mut free = self.free.lock().unwrap();
+        while *free == 0 {
+            free = self.released.wait(free).unwrap();
+        }
+        *free -= 1;
+        Slot(self)
+    }
+}
+
+impl Drop for Slot<'_> {
+    fn drop(&mut self) {
+        *self.0.free.lock().unwrap() += 1;
+        self.0.released.notify_one();
+    }
+}
+
+/// The slots of the replay processes of all `execute_pool` calls. The sanitization workers call
+/// `execute_pool` concurrently, so the shards of all of them share `max_cpu_count` processes.
+fn get_replay_slots() -> &'static Slots {
+    static REPLAY_SLOTS: OnceCell<Slots> = OnceCell::new();
+    REPLAY_SLOTS.get_or_init(|| Slots::new(max_cpu_count()))
+}
+
 #[derive(Default, Clone)]
 pub struct Executor {
     pub header_cmd: String,
@@ -100,42 +144,138 @@ impl Executor {
         (cflags, lib)
     }
 
-    /// compile programs into binary.
+    /// compile programs into binary. Each program is compiled to an object with the precompiled
+    /// header of its include prefix, and the objects are linked with the library separately.
     pub fn compile(&self, programs: Vec<&Path>, out: &Path, kind: Compile) -> Result<()> {
-        let (cflags, lib) = self.get_compile_flags(kind);
+        let (cflags, lib) = self.get_compile_flags(kind.clone());
+        let cache_key =
+            compile_cache::compute_key(&programs, &cflags, lib, &self.header_cmd, &self.deopt)?;
+        if compile_cache::fetch(&self.deopt, &cache_key, out)? {
+            return Ok(());
+        }
 
-        let mut cmd = Command::new("clang++");
-        for program in &programs {
-            cmd.arg(*program);
+        let mut objects = Vec::new();
+        let mut res = Ok(());
+        for (i, program) in programs.iter().enumerate() {
+            let object = PathBuf::from(format!("{}.{i}.o", out.to_string_lossy()));
+            let pch = self.get_program_pch(program, &kind);
+            res = self.compile_object(program, &object, &cflags, pch.as_deref());
+            objects.push(object);
+            if res.is_err() {
+                break;
+            }
         }
-        let include_fdp = "-I".to_owned() + Deopt::get_fdp_path()?.to_str().unwrap();
+        if res.is_ok() {
+            res = self.link_objects(&objects, out, &cflags, lib);
+        }
+        for object in &objects {
+            let _ = std::fs::remove_file(object);
+        }
+        if let Err(err) = res {
+            eyre::bail!("fail to compile {programs:?}\n, {err}");
+        }
+        if let Err(err) = compile_cache::store(&self.deopt, &cache_key, out) {
+            log::warn!("fail to store {out:?} in compile cache: {err}");
+        }
+        Ok(())
+    }
 
+    fn compile_object(
+        &self,
+        program: &Path,
+        object: &Path,
+        cflags: &[&str],
+        pch: Option<&Path>,
+    ) -> Result<()> {
+        let include_fdp = "-I".to_owned() + Deopt::get_fdp_path()?.to_str().unwrap();
+        let mut cmd = Command::new("clang++");
         let cmd = cmd
             .stdin(Stdio::null())
             .stdout(Stdio::null())
             .stderr(Stdio::piped())
-            .args(cflags.as_slice())
+            .arg("-c")
+            .arg(program)
+            .args(cflags)
             .arg(&self.header_cmd)
             .arg(include_fdp)
+            .arg("-g");
+        if let Some(pch) = pch {
+            cmd.arg("-include-pch").arg(pch);
+        }
+        cmd.arg("-o").arg(object);
+        self.deopt.add_extra_c_flags(cmd)?;
+
+        let output = cmd
+            .output()
+            .expect("failed to execute the compile process");
+        if !output.status.success() {
+            eyre::bail!("{}", String::from_utf8_lossy(&output.stderr));
+        }
+        Ok(())
+    }
+
+    fn link_objects(
+        &self,
+        objects: &[PathBuf],
+        out: &Path,
+        cflags: &[&str],
+        lib: &Path,
+    ) -> Result<()> {
+        let mut cmd = Command::new("clang++");
+        let cmd = cmd
+            .stdin(Stdio::null())
+            .stdout(Stdio::null())
+            .stderr(Stdio::piped())
+            .args(objects)
+            .args(cflags)
             .arg("-g")
             .arg("-o")
             .arg(out)
             .arg(lib);
+        if has_lld() {
+            cmd.arg("-fuse-ld=lld");
+        }
         self.deopt.add_extra_c_flags(cmd)?;
 
-        let output = cmd
-            .output()
-            .expect("failed to execute the syntax check process");
-        let success = output.status.success();
-        if !success {
-            eyre::bail!(
-                "fail to compile {programs:?}\n, {}",
-                String::from_utf8_lossy(&output.stderr)
-            );
+        let output = cmd.output().expect("failed to execute the link process");
+        if !output.status.success() {
+            eyre::bail!("{}", String::from_utf8_lossy(&output.stderr));
         }
         Ok(())
     }
 
+    /// Get the precompiled header of the include prefix of `program` for the flags of `kind`,
+    /// see `get_prefix_pch`.
+    pub fn get_program_pch(&self, program: &Path, kind: &Compile) -> Option<PathBuf> {
+        get_prefix_pch(program, &format!("{kind:?}"), |name, prefix| {
+            self.build_program_pch(kind.clone(), name, prefix)
+        })
+    }
+
+    fn build_program_pch(
+        &self,
+        kind: Compile,
+        name: &str,
+        prefix: &str,
+    ) -> Result<Option<PathBuf>> {
+        let (cflags, _) = self.get_compile_flags(kind);
+        let pch_dir: PathBuf = [self.deopt.get_library_misc_dir()?, "pch".into()]
+            .iter()
+            .collect();
+        crate::deopt::utils::create_dir_if_nonexist(&pch_dir)?;
+        let pch: PathBuf = [pch_dir, format!("{name}.h.pch").into()].iter().collect();
+        let include_fdp = "-I".to_owned() + Deopt::get_fdp_path()?.to_str().unwrap();
+        let mut args: Vec<String> = cflags.iter().map(|x| x.to_string()).collect();
+        args.push(self.header_cmd.clone());
+        args.push(include_fdp);
+        args.push("-g".to_string());
+        if !precompile_headers(&self.deopt, &pch, prefix, &args, true)? {
+            return Ok(None);
+        }
+        log::debug!("build the pch for {name}: {pch:?}");
+        Ok(Some(pch))
+    }
+
     pub fn spawn<S: AsRef<OsStr> + Debug>(
         &self,
         binary: &Path,
@@ -241,30 +381,38 @@ impl Executor {
         Ok(Some(ProgramError::Execute(err_msg)))
     }
 
+    /// Replay the corpus with persistent processes. The corpus is split into shards and each shard is
+    /// executed in a single process, so the process creation, ASan setup and library init are paid once per shard.
+    /// The shard processes of concurrent calls are bounded together by `get_replay_slots`.
     pub fn execute_pool(&self, binary: &Path, corpus: &Path) -> Option<ProgramError> {
-        let cpu_count = max_cpu_count();
         let corpus_files = crate::deopt::utils::read_all_files_in_dir(corpus).unwrap();
+        if corpus_files.is_empty() {
+            return None;
+        }
+        let shard_count = max_cpu_count().min(corpus_files.len());
+        let mut shards: Vec<Vec<PathBuf>> = vec![Vec::new(); shard_count];
+        for (i, corpus_file) in corpus_files.into_iter().enumerate() {
+            shards[i % shard_count].push(corpus_file);
+        }
 
-        let pool = ThreadPool::new(cpu_count);
+        let pool = ThreadPool::new(shard_count);
         let (tx, rx) = channel();
         let error_occurred = Arc::new(AtomicBool::new(false));
 
-        for corpus_file in &corpus_files {
+        for (shard_id, shard) in shards.into_iter().enumerate() {
             let tx = tx.clone();
             let binary = binary.to_path_buf();
-            let corpus_file = corpus_file.to_path_buf();
             let error_occurred = Arc::clone(&error_occurred);
             let executor = self.clone();
 
             pool.execute(move || {
+                let _slot = get_replay_slots().acquire();
                 // If an error has occurred in another thread, stop this one
                 if error_occurred.load(Ordering::SeqCst) {
                     return;
                 }
-
-                let args = vec![corpus_file.as_os_str()];
                 let has_err = executor
-                    .execute(&binary, args, vec![], None, None, false)
+                    .execute_shard(&binary, shard_id, &shard, &error_occurred)
                     .unwrap();
                 if has_err.is_some() {
                     error_occurred.store(true, Ordering::SeqCst);
@@ -273,10 +421,10 @@ impl Executor {
                     .expect("channel will be there waiting for the pool");
             });
         }
+        drop(tx);
         pool.join();
 
-        for _ in 0..corpus_files.len() {
-            let has_err = rx.recv().unwrap_or(None);
+        for has_err in rx.iter() {
             if let Some(err) = has_err {
                 return Some(err);
             }
@@ -284,6 +432,98 @@ impl Executor {
         None
     }
 
+    /// Execute a shard of corpus files in one libFuzzer process. The process is killed once another
+    /// shard has found an error. The input running at a failure is re-run on its own before it is
+    /// blamed, as the failure could come from the state left by the earlier inputs in the process.
+    /// If it passes on its own, the rest of the shard is replayed in a new process.
+    fn execute_shard(
+        &self,
+        binary: &Path,
+        shard_id: usize,
+        mut shard: &[PathBuf],
+        error_occurred: &AtomicBool,
+    ) -> Result<Option<ProgramError>> {
+        let log_file = binary.with_extension(format!("replay{shard_id}.log"));
+        while !shard.is_empty() {
+            let res = self.replay_shard(binary, shard, &log_file, error_occurred);
+            // the log is removed on every path, including the failures of the replay itself.
+            let _ = std::fs::remove_file(&log_file);
+            let Some((err, log)) = res? else {
+                return Ok(None);
+            };
+            let blamed = get_replay_input(&log)
+                .and_then(|input| shard.iter().position(|x| x.as_os_str() == input));
+            let Some(blamed) = blamed else {
+                return Ok(Some(err));
+            };
+            let input = vec![shard[blamed].as_os_str()];
+            if let Some(err) = self.execute(binary, input, vec![], None, None, false)? {
+                return Ok(Some(err));
+            }
+            log::debug!(
+                "{:?} passes on its own, its failure depends on the earlier inputs",
+                shard[blamed]
+            );
+            shard = &shard[blamed + 1..];
+        }
+        Ok(None)
+    }
+
+    /// Replay the inputs in one process, and return the error with the log of the replay.
+    fn replay_shard(
+        &self,
+        binary: &Path,
+        shard: &[PathBuf],
+        log_file: &Path,
+        error_occurred: &AtomicBool,
+    ) -> Result<Option<(ProgramError, String)>> {
+        let args: Vec<&OsStr> = shard.iter().map(|x| x.as_os_str()).collect();
+        let mut child = self.spawn(
+            binary,
+            args,
+            vec![],
+            None,
+            Some(std::fs::File::create(log_file)?.into()),
+            false,
+        );
+
+        // libFuzzer checks the timeout of each input, this only guards the whole process.
+        let timeout = (crate::config::EXECUTION_TIMEOUT + 1) * shard.len() as u64 + 3;
+        let mut cost_time: u64 = 0;
+        let status_code = loop {
+            if let Some(status) = child.wait_timeout(Duration::from_secs(1))? {
+                break Some(status);
+            }
+            cost_time += 1;
+            if cost_time >= timeout || error_occurred.load(Ordering::SeqCst) {
+                child.kill()?;
+                child.wait()?;
+                break None;
+            }
+        };
+        let log = String::from_utf8_lossy(&std::fs::read(log_file)?).to_string();
+
+        let status_code = match status_code {
+            Some(status) => status,
+            None if cost_time < timeout => return Ok(None),
+            None => {
+                let err_msg = format!(
+                    "Execute hang!\n Cmd: {child:#?}\n{}",
+                    attribute_replay_err(&log)
+                );
+                return Ok(Some((ProgramError::Hang(err_msg), log)));
+            }
+        };
+        if is_exit_normally(status_code.code()) {
+            return Ok(None);
+        }
+        let err_msg = attribute_replay_err(&log);
+        if err_msg.contains("libFuzzer: timeout") {
+            return Ok(Some((ProgramError::Hang(err_msg), log)));
+        }
+        Ok(Some((ProgramError::Execute(err_msg), log)))
+    }
+
     pub fn execute_fuzzer(&self, fuzzer: &Path, corpus: Vec<&Path>) -> Result<()> {
         // make up corpus for each standalone fuzzer.
         let dict = self.deopt.get_library_build_dict_path()?;
@@ -302,46 +542,52 @@ impl Executor {
             extra_args.push(OsString::from(dict_arg));
         }
 
-        let mut child = self.spawn(
-            fuzzer,
-            extra_args,
-            vec![],
-            None,
-            Some(std::fs::File::create(&log_file)?.into()),
-            false,
-        );
+        let mut child = self.spawn(fuzzer, extra_args, vec![], None, None, false);
+        // the live stats of libFuzzer are read from the pipe and also saved to log for the error report.
+        let features = Arc::new(AtomicUsize::new(0));
+        let inited = Arc::new(AtomicBool::new(false));
+        let stats_reader = {
+            let stderr = child.stderr.take().unwrap();
+            let log = std::fs::File::create(&log_file)?;
+            let features = Arc::clone(&features);
+            let inited = Arc::clone(&inited);
+            std::thread::spawn(move || read_fuzzer_stats(stderr, log, &features, &inited))
+        };
 
+        let window = get_config().fuzz_window.max(1);
+        let converge_rate = get_config().fuzz_converge_rate;
+        // the number of features at each second after the fuzzer is inited.
+        let mut samples: VecDeque<usize> = VecDeque::new();
         let mut cost_time: u64 = 0;
-        let mut previous_cov = None;
-        let mut should_break = false;
         loop {
-            if cost_time >= config::MAX_FUZZ_TIME {
-                should_break = true;
-            }
-            let wait_time = config::MIN_FUZZ_TIME;
-            // no coverage gained during config::MIN_FUZZ_TIME, break
-            if cost_time >= wait_time && cost_time % wait_time == 0 {
-                let cov = parse_cov_from_log(&log_file)?;
-                if let Some(cov) = cov {
-                    if let Some(p_cov) = previous_cov {
-                        if cov == p_cov {
-                            should_break = true;
-                        }
-                    } else {
-                        previous_cov = Some(cov)
-                    }
-                }
-            }
             match child.try_wait() {
                 Ok(Some(_status)) => {
+                    let _ = stats_reader.join();
                     let err_msg = std::fs::read_to_string(log_file)?;
                     eyre::bail!("cost time: {cost_time} \n{err_msg}")
                 }
                 Ok(None) => {
-                    log::debug!("{fuzzer:?} running.");
+                    let mut should_break = false;
+                    if cost_time >= config::MAX_FUZZ_TIME {
+                        log::debug!("{fuzzer:?} stops at the time limit: {cost_time}s.");
+                        should_break = true;
+                    }
+                    if inited.load(Ordering::SeqCst) {
+                        samples.push_back(features.load(Ordering::SeqCst));
+                        if samples.len() as u64 > window {
+                            let oldest = samples.pop_front().unwrap();
+                            let gain = samples.back().unwrap().saturating_sub(oldest);
+                            let rate = gain as f32 / window as f32;
+                            if rate < converge_rate {
+                                log::debug!("{fuzzer:?} converges at {cost_time}s: {gain} new features in the last {window}s.");
+                                should_break = true;
+                            }
+                        }
+                    }
                     if should_break {
                         child.kill()?;
                         child.wait()?;
+                        let _ = stats_reader.join();
                         return Ok(());
                     }
                 }
@@ -791,6 +1037,191 @@ impl Executor {
     }
 }
 
+/// Compile a program only with the pchs of its include prefix after this number of compilations.
+const PCH_MIN_USES: usize = 2;
+
+/// Get the precompiled header of the include prefix of `program`, named by `tag` and the digest
+/// of the prefix, and built by `build` from that name and the prefix.
+/// The pch only covers the directives the program has itself, so a program missing its
+/// includes still fails, and its macros defined before the includes still apply to them.
+/// A prefix is precompiled once it is used `PCH_MIN_USES` times, as a pch only pays off
+/// when reused. None if there is no such pch, e.g., some header has no include guard.
+fn get_prefix_pch(
+    program: &Path,
+    tag: &str,
+    build: impl FnOnce(&str, &str) -> Result<Option<PathBuf>>,
+) -> Option<PathBuf> {
+    static PCHS: OnceCell<Mutex<HashMap<String, PchSlot>>> = OnceCell::new();
+    let content = std::fs::read_to_string(program).ok()?;
+    let prefix = get_include_prefix(&content);
+    if !prefix.lines().any(is_include_directive) {
+        return None;
+    }
+    // the pch header lives in the pch dir, where the quoted includes next to the program
+    // would not be found. The pch is shared by programs in other dirs as well.
+    let dir = get_file_dirname(program);
+    let local_include = prefix
+        .lines()
+        .filter_map(get_quoted_include)
+        .find(|name| dir.join(name).is_file());
+    if let Some(name) = local_include {
+        log::debug!("no pch for {program:?}, which includes {name} from its own dir");
+        return None;
+    }
+    let mut hasher = crate::deopt::utils::StableHasher::new();
+    hasher.write(prefix.as_bytes());
+    let name = format!("{tag}.{}", hasher.finish_hex());
+    let pch = {
+        let mut pchs = PCHS.get_or_init(Default::default).lock().unwrap();
+        let slot = pchs.entry(name.clone()).or_default();
+        slot.uses += 1;
+        if slot.uses < PCH_MIN_USES {
+            return None;
+        }
+        slot.pch.clone()
+    };
+    // built outside the lock, so only the users of the same prefix wait for it.
+    let build = || match build(&name, prefix) {
+        Ok(pch) => pch,
+        Err(err) => {
+            log::warn!("fail to build the pch for {name}: {err}");
+            None
+        }
+    };
+    pch.get_or_init(build).clone()
+}
+
+#[derive(Default)]
+struct PchSlot {
+    uses: usize,
+    pch: Arc<OnceCell<Option<PathBuf>>>,
+}
+
+fn is_include_directive(line: &str) -> bool {
+    line.trim_start()
+        .strip_prefix('#')
+        .map_or(false, |directive| directive.trim_start().starts_with("include"))
+}
+
+/// The name in a quoted `#include "name"` directive.
+fn get_quoted_include(line: &str) -> Option<&str> {
+    let directive = line.trim_start().strip_prefix('#')?;
+    let target = directive.trim_start().strip_prefix("include")?;
+    let mut target = target.trim().split('"');
+    match (target.next(), target.next()) {
+        (Some(""), Some(name)) => Some(name),
+        _ => None,
+    }
+}
+
+/// The leading lines of a program that only consist of blank lines, line comments and the
+/// `#include`, `#define`, `#undef` and `#pragma` directives.
+pub fn get_include_prefix(content: &str) -> &str {
+    let mut end = 0;
+    for line in content.split_inclusive('\n') {
+        let trimmed = line.trim();
+        let is_prefix = if let Some(directive) = trimmed.strip_prefix('#') {
+            let directive = directive.trim_start();
+            ["include", "define", "undef", "pragma"]
+                .iter()
+                .any(|name| directive.starts_with(name))
+                && !trimmed.ends_with('\\')
+        } else {
+            trimmed.is_empty() || trimmed.starts_with("//")
+        };
+        if !is_prefix {
+            break;
+        }
+        end += line.len();
+    }
+    &content[..end]
+}
+
+/// Precompile the `preamble` to `pch` with `args`.
+/// Return false if the pch cannot be used: the programs include the headers again,
+/// which requires all headers have include guards.
+/// The pch is built aside and renamed into place, so other processes never see it half written.
+pub fn precompile_headers(
+    deopt: &Deopt,
+    pch: &Path,
+    preamble: &str,
+    args: &[String],
+    extra_c_flags: bool,
+) -> Result<bool> {
+    let header = pch.with_extension("");
+    let probe = pch.with_extension(format!("{}.probe.cc", std::process::id()));
+    let building = pch.with_extension(format!("{}.tmp", std::process::id()));
+    // the header is recorded in the pch, so it is not rewritten once it exists.
+    if !header.exists() {
+        let temp = header.with_extension(format!("{}.tmp", std::process::id()));
+        std::fs::write(&temp, preamble)?;
+        std::fs::rename(&temp, &header)?;
+    }
+    std::fs::write(&probe, format!("{preamble}int main() {{ return 0; }}\n"))?;
+
+    let mut cmd = Command::new("clang++");
+    let cmd = cmd
+        .stdin(Stdio::null())
+        .stdout(Stdio::null())
+        .stderr(Stdio::piped())
+        .arg("-x")
+        .arg("c++-header")
+        .arg(&header)
+        .args(args)
+        .arg("-o")
+        .arg(&building);
+    if extra_c_flags {
+        deopt.add_extra_c_flags(cmd)?;
+    }
+    let output = cmd.output().expect("failed to execute the pch process");
+    if !output.status.success() {
+        let _ = std::fs::remove_file(&probe);
+        log::warn!(
+            "fail to precompile the headers to {pch:?}:\n{}",
+            String::from_utf8_lossy(&output.stderr)
+        );
+        return Ok(false);
+    }
+
+    let mut cmd = Command::new("clang++");
+    let cmd = cmd
+        .stdin(Stdio::null())
+        .stdout(Stdio::null())
+        .stderr(Stdio::piped())
+        .arg("-fsyntax-only")
+        .args(args)
+        .arg("-include-pch")
+        .arg(&building)
+        .arg(&probe);
+    if extra_c_flags {
+        deopt.add_extra_c_flags(cmd)?;
+    }
+    let output = cmd.output().expect("failed to execute the pch process");
+    std::fs::remove_file(&probe)?;
+    if !output.status.success() {
+        std::fs::remove_file(&building)?;
+        log::warn!(
+            "the pch {pch:?} cannot be used, fall back to parse headers:\n{}",
+            String::from_utf8_lossy(&output.stderr)
+        );
+        return Ok(false);
+    }
+    std::fs::rename(&building, pch)?;
+    Ok(true)
+}
+
+/// link with lld if it is in the environment, which is much faster than the default linker.
+fn has_lld() -> bool {
+    static HAS_LLD: OnceCell<bool> = OnceCell::new();
+    *HAS_LLD.get_or_init(|| {
+        Command::new("ld.lld")
+            .arg("--version")
+            .output()
+            .map(|output| output.status.success())
+            .unwrap_or(false)
+    })
+}
+
 fn check_clang() -> Result<()> {
     let output = Command::new("clang++")
         .arg("-v")
@@ -818,6 +1249,66 @@ pub fn get_child_err(mut err: ChildStderr) -> String {
     err_msg
 }
 
+/// Copy the stderr of libFuzzer to `log`, and record the number of features in its status lines, e.g.,
+/// "#1024\tNEW    cov: 120 ft: 300 corp: 20/1Kb ...". `inited` is set once the initial corpus is loaded.
+fn read_fuzzer_stats(
+    stderr: ChildStderr,
+    mut log: std::fs::File,
+    features: &AtomicUsize,
+    inited: &AtomicBool,
+) {
+    let re = Regex::new(r"ft: (\d+)").unwrap();
+    let mut reader = std::io::BufReader::new(stderr);
+    let mut line = Vec::new();
+    loop {
+        line.clear();
+        match reader.read_until(b'\n', &mut line) {
+            Ok(0) | Err(_) => break,
+            Ok(_) => {}
+        }
+        let _ = log.write_all(&line);
+        let line = String::from_utf8_lossy(&line);
+        if line.contains("INITED") {
+            inited.store(true, Ordering::SeqCst);
+        }
+        if let Some(ft) = re.captures(&line).and_then(|x| x.get(1)) {
+            if let Ok(ft) = ft.as_str().parse::<usize>() {
+                features.store(ft, Ordering::SeqCst);
+            }
+        }
+    }
+}
+
+/// libFuzzer prints "Running: <file>" before executing each input, so the error belongs to the last one.
+/// The progress lines of the passed inputs are dropped from the message.
+/// The input that was running when a replay log ends.
+fn get_replay_input(log: &str) -> Option<&str> {
+    log.lines()
+        .filter_map(|line| line.strip_prefix("Running: "))
+        .last()
+}
+
+fn attribute_replay_err(log: &str) -> String {
+    let mut err_input = None;
+    let mut err_lines = Vec::new();
+    for line in log.lines() {
+        if let Some(input) = line.strip_prefix("Running: ") {
+            err_input = Some(input);
+            err_lines.clear();
+            continue;
+        }
+        if line.starts_with("Executed ") {
+            continue;
+        }
+        err_lines.push(line);
+    }
+    let err_msg = err_lines.join("\n");
+    if let Some(input) = err_input {
+        return format!("Error on corpus file: {input}\n{err_msg}");
+    }
+    err_msg
+}
+
 // mkdir the directory "corpus" under the same directory of fuzzer.
 fn mkdir_fuzzer_corpus(fuzzer_path: &Path) -> PathBuf {
     let mut corpus_dir = PathBuf::from(fuzzer_path);
@@ -862,20 +1353,6 @@ pub fn create_corpus_for_fuzzer(fuzzer_path: &Path, deopt: &Deopt) -> Result<Pat
     Ok(corpus_dir)
 }
 
-fn parse_cov_from_log(log_file: &Path) -> eyre::Result<Option<usize>> {
-    let msg = std::fs::read_to_string(log_file)?;
-    let last_line = msg.lines().last().ok_or_else(|| eyre::eyre!("{msg}"))?;
-    let re = Regex::new(r"cov: (\d+)")?;
-    if let Some(captures) = re.captures(last_line) {
-        if let Some(cov) = captures.get(1) {
-            let cov = cov.as_str();
-            let cov: usize = cov.parse()?;
-            return Ok(Some(cov));
-        }
-    }
-    Ok(None)
-}
-
 pub fn max_cpu_count() -> usize {
     let max_cores = get_config().max_cores;
     if max_cores == 0 {
@@ -907,4 +1384,27 @@ mod tests {
         println!("{res:#?}");
         Ok(())
     }
+
+    #[test]
+    fn test_attribute_replay_err() {
+        let log = "INFO: Seed: 42\nRunning: corpus/a\nExecuted corpus/a in 1 ms\nRunning: corpus/b\n==1==ERROR: AddressSanitizer: SEGV\nSUMMARY: AddressSanitizer: SEGV";
+        let err_msg = attribute_replay_err(log);
+        assert_eq!(get_replay_input(log), Some("corpus/b"));
+        assert_eq!(
+            err_msg,
+            "Error on corpus file: corpus/b\n==1==ERROR: AddressSanitizer: SEGV\nSUMMARY: AddressSanitizer: SEGV"
+        );
+    }
+
+    #[test]
+    fn test_include_prefix() {
+        let program = "// fuzz driver\n#define FOO 1\n#include <cJSON.h>\n\n#include \"FuzzedDataProvider.h\"\nint x;\n#include <vector>\n";
+        let prefix = get_include_prefix(program);
+        assert!(prefix.ends_with("#include \"FuzzedDataProvider.h\"\n"));
+        assert!(prefix.contains("#define FOO 1"));
+        assert!(!prefix.contains("<vector>"));
+        assert_eq!(get_include_prefix("int x;\n#include <vector>\n"), "");
+        assert_eq!(get_quoted_include("# include \"x.h\""), Some("x.h"));
+        assert_eq!(get_quoted_include("#include <vector>"), None);
+    }
 }
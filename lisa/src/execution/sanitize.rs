@@ -21,7 +21,7 @@ use std::{
     process::{Command, Stdio},
     time::Duration,
     io::Write,
-    sync::mpsc::channel,
+    sync::{mpsc::channel, Arc},
 };
 use wait_timeout::ChildExt;
 
@@ -29,10 +29,18 @@ impl Executor {
     /// check whether the c program is syntactically and semantically correct.
     fn is_program_syntax_correct(&self, program_path: &Path) -> Result<Option<ProgramError>> {
         let time_logger = TimeUsage::new(get_file_dirname(program_path));
-        let output: std::process::Output = Command::new("clang++")
-            .stdout(Stdio::null())
+        let mut cmd = Command::new("clang++");
+        cmd.stdout(Stdio::null())
             .arg("-fsyntax-only")
-            .arg(&self.header_cmd)
+            .arg(&self.header_cmd);
+        // the pch of Normal kind is built without any codegen flags, so it fits the syntax check.
+        // The extra flags are passed as well, since macros defined by them must match the pch.
+        if let Some(pch) = self.get_program_pch(program_path, &super::Compile::Normal) {
+            let include_fdp = "-I".to_owned() + Deopt::get_fdp_path()?.to_str().unwrap();
+            cmd.arg(include_fdp).arg("-include-pch").arg(pch);
+            self.deopt.add_extra_c_flags(&mut cmd)?;
+        }
+        let output: std::process::Output = cmd
             .arg(program_path.as_os_str())
             .output()
             .expect("failed to execute the syntax check process");
@@ -161,6 +169,9 @@ impl Executor {
         program: &Program,
         deopt: &Deopt,
     ) -> Result<Option<ProgramError>> {
+        if let Some(err) = &program.rejected {
+            return Ok(Some(err.clone()));
+        }
         // write the program to a temp file.
         let temp_path = deopt.get_work_seed_by_id(program.id)?;
         if let Some(parent) = temp_path.parent() {
@@ -345,7 +356,8 @@ impl Executor {
         deopt: &Deopt,
     ) -> Result<Vec<Option<ProgramError>>> {
         let mut program_paths = Vec::new();
-        for program in programs.iter() {
+        // the programs rejected while streaming fail as they are, only the others are checked.
+        for program in programs.iter().filter(|x| x.rejected.is_none()) {
             let temp_path = deopt.get_work_seed_by_id(program.id)?;
             let mut content = String::new();
             content.push_str(crate::deopt::utils::format_library_header_strings(deopt));
@@ -355,7 +367,9 @@ impl Executor {
         }
         let res = self.concurrent_check_batch(&program_paths)?;
         // print the time usage of the sanitization
-        utils::print_san_cost(&program_paths)?;
+        if !program_paths.is_empty() {
+            utils::print_san_cost(&program_paths)?;
+        }
 
         // clean out the failure cache.
         for (i, has_err) in res.iter().enumerate() {
@@ -373,50 +387,60 @@ impl Executor {
                 std::fs::remove_dir_all(dir)?;
             }
         }
+        let mut res = res.into_iter();
+        let res = programs
+            .iter()
+            .map(|program| match &program.rejected {
+                Some(err) => Some(err.clone()),
+                None => res.next().expect("a result per checked program"),
+            })
+            .collect();
         Ok(res)
     }
 
-    /// Using multi-process to run a fixed size of batch of programs, and check the program correctness.
+    /// Run a batch of programs on the long-lived sanitization workers, and check the program correctness.
+    /// The gadgets, header strings and call graph are process-wide statics, so the workers load them only once.
     pub fn concurrent_check_batch(
         &self,
         programs: &[PathBuf],
     ) -> Result<Vec<Option<ProgramError>>> {
-        let mut childs = Vec::new();
-        for program in programs {
-            let child = Command::new("cargo")
-                .env("RUST_BACKTRACE", "full")
-                .arg("run")
-                .arg("-q")
-                .arg("--bin")
-                .arg("harness")
-                .arg("--")
-                .arg(get_library_name())
-                .arg("check")
-                .arg(program)
-                .stdout(Stdio::null())
-                .stderr(Stdio::piped())
-                .spawn()
-                .expect("failed to execute the concurrent transform process");
-            childs.push(child);
+        let pool = utils::get_sanitize_pool();
+        let executor = Arc::new(self.clone());
+        let (tx, rx) = channel();
+        for (i, program) in programs.iter().enumerate() {
+            let tx = tx.clone();
+            let executor = Arc::clone(&executor);
+            let program = program.clone();
+            pool.execute(move || {
+                let has_err = match executor.check_program_is_correct(&program) {
+                    Ok(has_err) => has_err,
+                    Err(err) => Some(ProgramError::Fuzzer(err.to_string())),
+                };
+                tx.send((i, has_err))
+                    .expect("channel will be there waiting for the pool");
+            });
+        }
+        drop(tx);
+
+        // a panicked worker drops its sender without a result, treat it as a fuzzer error.
+        let mut results: Vec<Option<Option<ProgramError>>> = vec![None; programs.len()];
+        for (i, has_err) in rx.iter() {
+            results[i] = Some(has_err);
         }
         let mut has_errs: Vec<Option<ProgramError>> = Vec::new();
-        // for each child process, wait output and log the error reason.
-        for (i, child) in childs.into_iter().enumerate() {
-            let output = child.wait_with_output().expect("command wasn't running");
+        for (i, res) in results.into_iter().enumerate() {
             let program = programs.get(i).unwrap();
-            if !output.status.success() {
-                let err_msg = String::from_utf8_lossy(&output.stderr).to_string();
-                let p_err = serde_json::from_str::<ProgramError>(&err_msg);
-                if let Ok(err) = p_err {
-                    has_errs.push(Some(err));
-                } else {
-                    has_errs.push(Some(ProgramError::Fuzzer(err_msg)));
-                }
+            let has_err = res.unwrap_or_else(|| {
+                Some(ProgramError::Fuzzer(
+                    "sanitization worker panicked".to_string(),
+                ))
+            });
+            if has_err.is_some() {
                 log::trace!("error: {program:?}");
             } else {
-                has_errs.push(None);
                 log::trace!("correct: {program:?}");
             }
+            has_errs.push(has_err);
         }
         Ok(has_errs)
     }
@@ -501,10 +525,28 @@ impl Executor {
 
 pub mod utils {
 
-    use crate::execution::logger::get_gtl_mut;
+    use crate::execution::{logger::get_gtl_mut, max_cpu_count};
+    use once_cell::sync::OnceCell;
+    use std::sync::Mutex;
+    use threadpool::ThreadPool;
 
     use super::*;
 
+    static SANITIZE_POOL: OnceCell<Mutex<ThreadPool>> = OnceCell::new();
+
+    /// The sanitization workers live across rounds, and the size is bounded by `--max-cores`.
+    pub fn get_sanitize_pool() -> ThreadPool {
+        SANITIZE_POOL
+            .get_or_init(|| {
+                let cpu_count = max_cpu_count();
+                log::info!("spawn {cpu_count} sanitization workers");
+                Mutex::new(ThreadPool::with_name("sanitizer".to_string(), cpu_count))
+            })
+            .lock()
+            .unwrap()
+            .clone()
+    }
+
     pub fn print_san_cost(program_paths: &Vec<PathBuf>) -> Result<()> {
         let mut max_time = 0_f32;
         let mut usage = Vec::new();
@@ -538,6 +580,7 @@ pub mod utils {
         }
         log::debug!("This round's sanitization Time Cost: total: {max_time}s, syntax: {}s, link: {}s, exec: {}s, fuzz: {}s, coverage: {}s, update: {}s", usage[0], usage[1], usage[2], usage[3], usage[4], usage[5]);
         get_gtl_mut().inc_san(usage[0], usage[1], usage[2], usage[3], usage[4], usage[5]);
+        crate::execution::compile_cache::log_cache_stats();
         Ok(())
     }
 
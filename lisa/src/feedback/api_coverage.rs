@@ -0,0 +1,156 @@
+//! The recursive branch coverage of library APIs, i.e., the coverage of all functions reachable from an API.
+//! The call graph is condensed into SCCs once, and the coverage of each SCC is aggregated incrementally:
+//! only the SCCs reaching a function whose branch status changed are updated per round.
+use petgraph::{algo::tarjan_scc, Directed, Graph};
+
+use super::branches::GlobalBranches;
+
+pub struct RecursiveCoverage {
+    /// The SCC of each function, indexed by the function id of GlobalBranches.
+    scc_of: Vec<usize>,
+    /// The SCCs reachable from each SCC (including itself), as bitsets.
+    reach: Vec<Vec<u64>>,
+    /// The branch status (covered, total) of each function at the last update.
+    status: Vec<(u32, u32)>,
+    /// The sum of branch status of functions reachable from each SCC.
+    sums: Vec<(i64, i64)>,
+}
+
+impl RecursiveCoverage {
+    /// Condense the call graph among `func_names`, whose indexes are the function ids.
+    /// Functions out of `func_names` (e.g., std library functions) are not counted and not traversed.
+    pub fn new<'a, F>(func_names: &[&'a str], get_callees: F) -> Self
+    where
+        F: Fn(&str) -> Vec<&'a str>,
+    {
+        let func_ids: std::collections::HashMap<&str, usize> = func_names
+            .iter()
+            .enumerate()
+            .map(|(id, name)| (*name, id))
+            .collect();
+        let mut graph: Graph<usize, (), Directed> = Graph::new();
+        let nodes: Vec<_> = (0..func_names.len()).map(|id| graph.add_node(id)).collect();
+        for (id, func) in func_names.iter().enumerate() {
+            for callee in get_callees(func) {
+                if let Some(callee_id) = func_ids.get(callee) {
+                    graph.add_edge(nodes[id], nodes[*callee_id], ());
+                }
+            }
+        }
+
+        // tarjan_scc returns SCCs in post order, thus the callees of a SCC precede it.
+        let sccs = tarjan_scc(&graph);
+        let mut scc_of = vec![0; func_names.len()];
+        for (scc_id, scc) in sccs.iter().enumerate() {
+            for node in scc {
+                scc_of[graph[*node]] = scc_id;
+            }
+        }
+        let words = (sccs.len() + 63) / 64;
+        let mut reach: Vec<Vec<u64>> = Vec::with_capacity(sccs.len());
+        for (scc_id, scc) in sccs.iter().enumerate() {
+            let mut bits = vec![0_u64; words];
+            bits[scc_id / 64] |= 1 << (scc_id % 64);
+            for node in scc {
+                for callee in graph.neighbors(*node) {
+                    let callee_scc = scc_of[graph[callee]];
+                    if callee_scc == scc_id {
+                        continue;
+                    }
+                    assert!(callee_scc < scc_id);
+                    for (word, callee_word) in bits.iter_mut().zip(&reach[callee_scc]) {
+                        *word |= callee_word;
+                    }
+                }
+            }
+            reach.push(bits);
+        }
+        Self {
+            scc_of,
+            status: vec![(0, 0); func_names.len()],
+            sums: vec![(0, 0); reach.len()],
+            reach,
+        }
+    }
+
+    pub fn from_global_branches(branches: &GlobalBranches) -> Self {
+        let call_graph = crate::analysis::callgraph::get_lib_call_graph();
+        let func_names: Vec<&str> = branches.iter_func_names().collect();
+        Self::new(&func_names, |func| {
+            if call_graph.contains(func) {
+                call_graph.get_direct_callees(func)
+            } else {
+                Vec::new()
+            }
+        })
+    }
+
+    /// Update the branch status of a function, and add the change to the SCCs reaching it.
+    pub fn update_func_status(&mut self, id: usize, status: (u32, u32)) {
+        let prev = self.status[id];
+        if prev == status {
+            return;
+        }
+        self.status[id] = status;
+        let covered_delta = status.0 as i64 - prev.0 as i64;
+        let total_delta = status.1 as i64 - prev.1 as i64;
+        let scc = self.scc_of[id];
+        let (word, bit) = (scc / 64, 1_u64 << (scc % 64));
+        for (bits, sum) in self.reach.iter().zip(self.sums.iter_mut()) {
+            if bits[word] & bit != 0 {
+                sum.0 += covered_delta;
+                sum.1 += total_delta;
+            }
+        }
+    }
+
+    pub fn update_from_global_branches(&mut self, branches: &GlobalBranches) {
+        for id in 0..branches.get_func_num() {
+            self.update_func_status(id, branches.compute_func_branch_status_by_id(id));
+        }
+    }
+
+    /// The (covered, total) branches of all functions reachable from the function.
+    pub fn get_recursive_status(&self, id: usize) -> (u32, u32) {
+        let (covered, total) = self.sums[self.scc_of[id]];
+        (covered as u32, total as u32)
+    }
+
+    pub fn get_func_num(&self) -> usize {
+        self.status.len()
+    }
+
+    pub fn get_func_status(&self, id: usize) -> (u32, u32) {
+        self.status[id]
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_recursive_coverage() {
+        // a -> b <-> c -> d, a -> d, d -> printf
+        let func_names = ["a", "b", "c", "d"];
+        let get_callees = |func: &str| match func {
+            "a" => vec!["b", "d"],
+            "b" => vec!["c"],
+            "c" => vec!["b", "d"],
+            "d" => vec!["printf"],
+            _ => vec![],
+        };
+        let mut coverage = RecursiveCoverage::new(&func_names, get_callees);
+        for (id, status) in [(1, 4), (2, 4), (0, 2), (3, 6)].into_iter().enumerate() {
+            coverage.update_func_status(id, status);
+        }
+        assert_eq!(coverage.get_recursive_status(0), (6, 16));
+        assert_eq!(coverage.get_recursive_status(1), (5, 12));
+        assert_eq!(coverage.get_recursive_status(2), (5, 12));
+        assert_eq!(coverage.get_recursive_status(3), (3, 6));
+
+        coverage.update_func_status(3, (5, 6));
+        assert_eq!(coverage.get_recursive_status(0), (8, 16));
+        assert_eq!(coverage.get_recursive_status(2), (7, 12));
+    }
+}
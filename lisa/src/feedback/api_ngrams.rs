@@ -0,0 +1,381 @@
+//! The API n-grams discovered in ApiCombination mode. API names are interned to u32 ids, with the library
+//! APIs taking the ids in the order of the gadget table, and an n-gram of ids is packed into a u128 key.
+//! The keys are kept in a set sharded by hash, and the n-grams of each seed are persisted in an append-only log.
+use std::{
+    collections::{HashMap, HashSet},
+    fs::File,
+    hash::{BuildHasher, BuildHasherDefault, Hasher},
+    io::{BufWriter, Read, Write},
+    path::{Path, PathBuf},
+    sync::{Mutex, RwLock},
+};
+
+use eyre::Result;
+use once_cell::sync::OnceCell;
+
+use crate::program::gadget::get_func_gadgets;
+
+pub type ApiNgram = u128;
+
+/// The n-gram length should be in 2..=MAX_NGRAM_LEN, as an id takes 32 bits of the key.
+pub const MAX_NGRAM_LEN: usize = 4;
+
+const SHARD_NUM: usize = 16;
+
+struct ApiInterner {
+    ids: HashMap<&'static str, u32>,
+    names: Vec<&'static str>,
+}
+
+fn get_interner() -> &'static RwLock<ApiInterner> {
+    static INTERNER: OnceCell<RwLock<ApiInterner>> = OnceCell::new();
+    INTERNER.get_or_init(|| {
+        let mut interner = ApiInterner {
+            ids: HashMap::new(),
+            names: Vec::new(),
+        };
+        for gadget in get_func_gadgets() {
+            let name = gadget.get_func_name();
+            if !interner.ids.contains_key(name) {
+                interner.ids.insert(name, interner.names.len() as u32);
+                interner.names.push(name);
+            }
+        }
+        RwLock::new(interner)
+    })
+}
+
+/// Intern an API name. The names out of the gadget table (e.g., std functions) get ids on their first appearance.
+pub fn intern_api(name: &str) -> u32 {
+    if let Some(id) = get_interner().read().unwrap().ids.get(name) {
+        return *id;
+    }
+    let mut interner = get_interner().write().unwrap();
+    if let Some(id) = interner.ids.get(name) {
+        return *id;
+    }
+    // the names out of the gadget table are bounded by the distinct callees in seeds.
+    let name: &'static str = Box::leak(name.to_string().into_boxed_str());
+    let id = interner.names.len() as u32;
+    interner.ids.insert(name, id);
+    interner.names.push(name);
+    id
+}
+
+pub fn get_api_name(id: u32) -> &'static str {
+    get_interner().read().unwrap().names[id as usize]
+}
+
+/// The number of interned names.
+pub fn get_api_num() -> usize {
+    get_interner().read().unwrap().names.len()
+}
+
+/// Pack an n-gram of ids, each id is shifted by one so that n-grams of different lengths never collide.
+pub fn pack_ngram(ids: &[u32]) -> ApiNgram {
+    assert!(ids.len() <= MAX_NGRAM_LEN);
+    let mut key: ApiNgram = 0;
+    for (i, id) in ids.iter().enumerate() {
+        key |= ((*id as ApiNgram) + 1) << (32 * i);
+    }
+    key
+}
+
+pub fn unpack_ngram(key: ApiNgram) -> Vec<u32> {
+    let mut ids = Vec::new();
+    let mut key = key;
+    while key != 0 {
+        ids.push((key & u32::MAX as ApiNgram) as u32 - 1);
+        key >>= 32;
+    }
+    ids
+}
+
+/// The names of an n-gram.
+pub fn get_ngram_names(key: ApiNgram) -> Vec<&'static str> {
+    unpack_ngram(key).into_iter().map(get_api_name).collect()
+}
+
+/// Extract the n-grams of length `n` from a call sequence.
+pub fn extract_ngrams(calls: &[String], n: usize) -> Vec<ApiNgram> {
+    let ids: Vec<u32> = calls.iter().map(|x| intern_api(x)).collect();
+    ids.windows(n).map(pack_ngram).collect()
+}
+
+/// A cheap hasher for the packed keys, which folds the key into 64 bits and mixes them.
+#[derive(Default)]
+pub struct NgramHasher(u64);
+
+impl Hasher for NgramHasher {
+    fn finish(&self) -> u64 {
+        self.0
+    }
+
+    fn write(&mut self, bytes: &[u8]) {
+        for byte in bytes {
+            self.0 = (self.0 ^ *byte as u64).wrapping_mul(0x100000001b3);
+        }
+    }
+
+    fn write_u128(&mut self, key: u128) {
+        let folded = (key as u64) ^ ((key >> 64) as u64).rotate_left(29);
+        self.0 = folded.wrapping_mul(0x9E3779B97F4A7C15);
+    }
+}
+
+pub type NgramBuildHasher = BuildHasherDefault<NgramHasher>;
+
+pub type NgramSet = HashSet<ApiNgram, NgramBuildHasher>;
+
+/// A concurrent set of n-grams, sharded by hash so that the generation lanes rarely contend on a lock.
+pub struct ApiNgramSet {
+    shards: Vec<Mutex<NgramSet>>,
+}
+
+impl Default for ApiNgramSet {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+impl ApiNgramSet {
+    pub fn new() -> Self {
+        Self {
+            shards: (0..SHARD_NUM)
+                .map(|_| Mutex::new(NgramSet::default()))
+                .collect(),
+        }
+    }
+
+    fn get_shard(&self, key: ApiNgram) -> &Mutex<NgramSet> {
+        let hash = NgramBuildHasher::default().hash_one(key);
+        // the tables in the shards take the bucket from the low bits of the hash and the control
+        // tag from the top 7 bits, so the shard is taken from a rehash rather than fixing either.
+        let rehash = (hash ^ (hash >> 32)).wrapping_mul(0xD6E8FEB86659FD93);
+        &self.shards[(rehash >> 60) as usize % SHARD_NUM]
+    }
+
+    /// Insert an n-gram, return true if it has not been discovered.
+    pub fn insert(&self, key: ApiNgram) -> bool {
+        self.get_shard(key).lock().unwrap().insert(key)
+    }
+
+    pub fn contains(&self, key: ApiNgram) -> bool {
+        self.get_shard(key).lock().unwrap().contains(&key)
+    }
+
+    pub fn len(&self) -> usize {
+        self.shards.iter().map(|x| x.lock().unwrap().len()).sum()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+}
+
+/// The append-only log of the n-grams of each seed, which replaces a text file per seed.
+/// The log is kept across runs, as the seeds are. The ids are interned per run, so each run
+/// writes its own names table, and each record refers to the table of its run.
+/// - `ngrams.log`: [seed id: u64][run: u64][count: u64][count * key: u128], little endian.
+/// - `ngrams.names.{run}`: the interned names of the run in the order of ids, one per line.
+pub struct ApiNgramLog {
+    log: BufWriter<File>,
+    names: BufWriter<File>,
+    run: u64,
+    names_written: usize,
+}
+
+impl ApiNgramLog {
+    fn get_log_path(dir: &Path) -> PathBuf {
+        dir.join("ngrams.log")
+    }
+
+    fn get_names_path(dir: &Path, run: u64) -> PathBuf {
+        dir.join(format!("ngrams.names.{run}"))
+    }
+
+    /// Open the log in `dir` to append the records of a new run. A record left incomplete by an
+    /// interrupted run is cut off.
+    pub fn create(dir: &Path) -> Result<Self> {
+        crate::deopt::utils::create_dir_if_nonexist(dir)?;
+        let log = Self::get_log_path(dir);
+        let mut run = 0;
+        while Self::get_names_path(dir, run).exists() {
+            run += 1;
+        }
+        if log.exists() {
+            let (_, offset) = Self::read_records(&log)?;
+            File::options().write(true).open(&log)?.set_len(offset)?;
+        }
+        let log = File::options().create(true).append(true).open(&log)?;
+        Ok(Self {
+            log: BufWriter::new(log),
+            names: BufWriter::new(File::create(Self::get_names_path(dir, run))?),
+            run,
+            names_written: 0,
+        })
+    }
+
+    pub fn append(&mut self, seed_id: usize, ngrams: &[ApiNgram]) -> Result<()> {
+        // the names of the ids in this record reach the disk before the record does.
+        let api_num = get_api_num();
+        if api_num > self.names_written {
+            for id in self.names_written..api_num {
+                writeln!(self.names, "{}", get_api_name(id as u32))?;
+            }
+            self.names.flush()?;
+            self.names_written = api_num;
+        }
+        self.log.write_all(&(seed_id as u64).to_le_bytes())?;
+        self.log.write_all(&self.run.to_le_bytes())?;
+        self.log.write_all(&(ngrams.len() as u64).to_le_bytes())?;
+        for key in ngrams {
+            self.log.write_all(&key.to_le_bytes())?;
+        }
+        Ok(())
+    }
+
+    pub fn flush(&mut self) -> Result<()> {
+        self.names.flush()?;
+        self.log.flush()?;
+        Ok(())
+    }
+
+    /// Read the complete records of a log, and the length of the log they take.
+    fn read_records(log: &Path) -> Result<(Vec<(usize, u64, Vec<ApiNgram>)>, u64)> {
+        let mut reader = std::io::BufReader::new(File::open(log)?);
+        let mut records = Vec::new();
+        let mut offset = 0;
+        let mut word = [0_u8; 8];
+        let mut key = [0_u8; 16];
+        let mut read_record = |records: &mut Vec<_>| -> std::io::Result<u64> {
+            reader.read_exact(&mut word)?;
+            let seed_id = u64::from_le_bytes(word) as usize;
+            reader.read_exact(&mut word)?;
+            let run = u64::from_le_bytes(word);
+            reader.read_exact(&mut word)?;
+            let count = u64::from_le_bytes(word) as usize;
+            let mut ngrams = Vec::with_capacity(count.min(1 << 16));
+            for _ in 0..count {
+                reader.read_exact(&mut key)?;
+                ngrams.push(u128::from_le_bytes(key));
+            }
+            records.push((seed_id, run, ngrams));
+            Ok(24 + 16 * count as u64)
+        };
+        loop {
+            match read_record(&mut records) {
+                Ok(len) => offset += len,
+                Err(err) if err.kind() == std::io::ErrorKind::UnexpectedEof => break,
+                Err(err) => return Err(err.into()),
+            }
+        }
+        Ok((records, offset))
+    }
+
+    /// Read back the n-grams of all seeds in the log of `dir`, with the names of their ids.
+    /// The records with ids missing from the names table of their run are dropped, which are
+    /// only left by a run interrupted before its table was written out.
+    pub fn read_all(dir: &Path) -> Result<Vec<(usize, Vec<Vec<String>>)>> {
+        let (records, _) = Self::read_records(&Self::get_log_path(dir))?;
+        let mut names: HashMap<u64, Vec<String>> = HashMap::new();
+        let mut resolved = Vec::new();
+        for (seed_id, run, ngrams) in records {
+            if !names.contains_key(&run) {
+                let table = std::fs::read_to_string(Self::get_names_path(dir, run))?;
+                names.insert(run, table.lines().map(|x| x.to_string()).collect());
+            }
+            let table = &names[&run];
+            let ngrams: Option<Vec<Vec<String>>> = ngrams
+                .into_iter()
+                .map(|key| {
+                    let ids = unpack_ngram(key).into_iter();
+                    ids.map(|id| table.get(id as usize).cloned()).collect()
+                })
+                .collect();
+            match ngrams {
+                Some(ngrams) => resolved.push((seed_id, ngrams)),
+                None => log::warn!("drop the n-grams of seed {seed_id} with unnamed ids"),
+            }
+        }
+        Ok(resolved)
+    }
+}
+
+impl Drop for ApiNgramLog {
+    fn drop(&mut self) {
+        let _ = self.flush();
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_pack_ngram() {
+        for ids in [vec![0, 1], vec![3, 0, 7], vec![u32::MAX - 1, 2, 0, 5]] {
+            assert_eq!(unpack_ngram(pack_ngram(&ids)), ids);
+        }
+        assert_ne!(pack_ngram(&[0, 1]), pack_ngram(&[0, 1, 0]));
+    }
+
+    #[test]
+    fn test_concurrent_insert() {
+        let ngrams = ApiNgramSet::new();
+        std::thread::scope(|s| {
+            for _ in 0..4 {
+                s.spawn(|| {
+                    for i in 0..100 {
+                        ngrams.insert(pack_ngram(&[i, 1, 2]));
+                    }
+                });
+            }
+        });
+        assert_eq!(ngrams.len(), 100);
+        assert!(ngrams.contains(pack_ngram(&[1, 1, 2])));
+        assert!(!ngrams.insert(pack_ngram(&[1, 1, 2])));
+    }
+
+    #[test]
+    fn test_ngram_log() -> Result<()> {
+        crate::config::Config::init_test("cJSON");
+        let dir = std::env::temp_dir().join("lisa_ngram_log_test");
+        if dir.exists() {
+            std::fs::remove_dir_all(&dir)?;
+        }
+        let calls: Vec<String> = ["foo_open", "foo_read", "foo_close", "free"]
+            .iter()
+            .map(|x| x.to_string())
+            .collect();
+        let ngrams = extract_ngrams(&calls, 3);
+        assert_eq!(ngrams.len(), 2);
+        {
+            let mut log = ApiNgramLog::create(&dir)?;
+            log.append(7, &ngrams)?;
+            log.append(9, &[])?;
+        }
+        // a later run appends to the log, and an interrupted record is cut off.
+        {
+            let mut log = std::fs::OpenOptions::new()
+                .append(true)
+                .open(dir.join("ngrams.log"))?;
+            log.write_all(&[1, 2, 3])?;
+        }
+        {
+            let mut log = ApiNgramLog::create(&dir)?;
+            log.append(11, &ngrams[..1])?;
+        }
+        let records = ApiNgramLog::read_all(&dir)?;
+        let seed_ids: Vec<usize> = records.iter().map(|x| x.0).collect();
+        assert_eq!(seed_ids, vec![7, 9, 11]);
+        assert_eq!(records[0].1[1], vec!["foo_read", "foo_close", "free"]);
+        assert_eq!(records[2].1[0], vec!["foo_open", "foo_read", "foo_close"]);
+        // a record whose names were lost with an interrupted run is dropped.
+        std::fs::write(ApiNgramLog::get_names_path(&dir, 1), "")?;
+        let seed_ids: Vec<usize> = ApiNgramLog::read_all(&dir)?.iter().map(|x| x.0).collect();
+        assert_eq!(seed_ids, vec![7, 9]);
+        std::fs::remove_dir_all(&dir)?;
+        Ok(())
+    }
+}
@@ -1,13 +1,44 @@
-use crate::{
-    analysis::callgraph::get_lib_call_graph, config::get_config, program::get_exec_counter_value,
-};
-use std::collections::{HashMap, HashSet};
+use crate::program::get_exec_counter_value;
+use std::{cell::RefCell, collections::HashMap};
 
 use super::clang_coverage::{CodeCoverage, CovBranch};
 
 type BucketType = u32;
 const BUCKET_MASK: BucketType = BucketType::MAX;
 
+thread_local! {
+    static SCRATCH: RefCell<CheckScratch> = RefCell::new(CheckScratch::default());
+}
+
+#[cfg(test)]
+thread_local! {
+    /// The bucket slots visited by `merge_branch_states` on this thread, i.e., the work of merges.
+    static MERGE_VISITS: std::cell::Cell<usize> = std::cell::Cell::new(0);
+}
+
+/// The buffers of `GlobalBranches::check_new` reused across calls on a thread. A function is
+/// visited in a call if its stamp equals the epoch of the call, so no reset is needed per call.
+#[derive(Default)]
+struct CheckScratch {
+    visited: Vec<u32>,
+    epoch: u32,
+    trace: Vec<BucketType>,
+}
+
+impl CheckScratch {
+    fn next_epoch(&mut self, func_num: usize) -> u32 {
+        if self.visited.len() < func_num {
+            self.visited.resize(func_num, 0);
+        }
+        self.epoch = self.epoch.wrapping_add(1);
+        if self.epoch == 0 {
+            self.visited.fill(0);
+            self.epoch = 1;
+        }
+        self.epoch
+    }
+}
+
 /// line_start, col_strat, line_end, col_end, fileid, expand_file_id, kind, True or false branch,
 /// those 8 numbers idenitify an unique branch
 pub type Branch = [usize; 8];
@@ -27,11 +58,23 @@ pub struct BranchState {
     branch: Branch,
     // 16 bit map respond for branch hit.
     bucket: BucketType,
+    /// The position of this branch in its function, set by `check_branch_states`.
+    #[serde(default)]
+    index: usize,
 }
 
 impl BranchState {
     fn new(branch: Branch, bucket: BucketType) -> Self {
-        Self { branch, bucket }
+        Self {
+            branch,
+            bucket,
+            index: 0,
+        }
+    }
+
+    fn with_index(mut self, index: usize) -> Self {
+        self.index = index;
+        self
     }
 
     // count = 200;
@@ -48,17 +91,6 @@ impl BranchState {
         }
     }
 
-    fn from_llvm_cov(func_state: &CovBranch) -> (Self, Self) {
-        let (true_branch, false_branch) = parse_branch(func_state);
-
-        let true_bucket = Self::calculate_bucket_count(func_state[4]);
-        let false_bucket = Self::calculate_bucket_count(func_state[5]);
-
-        let true_state = Self::new(true_branch, true_bucket);
-        let false_state = Self::new(false_branch, false_bucket);
-        (true_state, false_state)
-    }
-
     pub fn clear_bucket(mut self) -> Self {
         self.bucket = BUCKET_MASK;
         self
@@ -83,9 +115,11 @@ impl BranchState {
         false
     }
 
-    pub fn check_new(&self, func_state: &BranchState) -> bool {
+    /// Check whether `func_state` hits a new bucket of this branch. With `exponent_branch`, a hit count
+    /// in a new power of two is new, otherwise only the first hit of this branch is new.
+    pub fn check_new(&self, func_state: &BranchState, exponent_branch: bool) -> bool {
         let bucket = func_state.bucket;
-        if get_config().exponent_branch {
+        if exponent_branch {
             self.check_exponential_new(bucket)
         } else {
             self.check_absolute_new(bucket)
@@ -97,40 +131,39 @@ impl BranchState {
     }
 }
 
-#[derive(serde::Serialize, serde::Deserialize)]
+/// The branches of a function, which occupy `len` slots from `offset` in the global bucket map.
+#[derive(serde::Serialize)]
 pub struct FuncBranches {
-    branches: Vec<BranchState>,
+    name: String,
+    offset: usize,
+    len: usize,
 }
 
 impl FuncBranches {
-    pub fn new(branches: Vec<BranchState>) -> Self {
-        Self { branches }
+    pub fn get_name(&self) -> &str {
+        &self.name
     }
 
-    pub fn get_branches(&self) -> &Vec<BranchState> {
-        &self.branches
-    }
-
-    pub fn get_branches_mut(&mut self) -> &mut Vec<BranchState> {
-        &mut self.branches
-    }
-
-    pub fn get_branch_status(&self) -> (u32, u32) {
-        let mut covered = 0_u32;
-        let mut total = 0_u32;
-        for branch in &self.branches {
-            if branch.bucket != BUCKET_MASK {
-                covered += 1;
-            }
-            total += 1;
-        }
-        (covered, total)
+    fn range(&self) -> std::ops::Range<usize> {
+        self.offset..self.offset + self.len
     }
 }
 
-#[derive(serde::Serialize, serde::Deserialize)]
+/// The global branch map, in the spirit of AFL's virgin map: functions are interned to dense ids,
+/// and the buckets of all branches are stored in one contiguous array, so that checking a coverage
+/// sample only compares slices of the covered functions.
+#[derive(serde::Serialize)]
 pub struct GlobalBranches {
-    branches: HashMap<String, FuncBranches>,
+    funcs: Vec<FuncBranches>,
+    #[serde(skip)]
+    func_ids: HashMap<String, usize>,
+    /// The identities of branches, parallel to `buckets`.
+    branches: Vec<Branch>,
+    buckets: Vec<BucketType>,
+    /// The function ids in the order of the coverage used to init, which is the order of the later
+    /// coverages exported for the same library as well. Used to look up ids without hashing.
+    #[serde(skip)]
+    order: Vec<usize>,
 }
 
 impl Default for GlobalBranches {
@@ -142,60 +175,204 @@ impl Default for GlobalBranches {
 impl GlobalBranches {
     pub fn new() -> Self {
         Self {
-            branches: HashMap::new(),
+            funcs: Vec::new(),
+            func_ids: HashMap::new(),
+            branches: Vec::new(),
+            buckets: Vec::new(),
+            order: Vec::new(),
         }
     }
 
     pub fn is_empty(&self) -> bool {
-        self.branches.is_empty()
+        self.funcs.is_empty()
     }
 
-    pub fn get_entity(&self) -> &HashMap<String, FuncBranches> {
-        &self.branches
+    pub fn iter_func_names(&self) -> impl Iterator<Item = &str> {
+        self.funcs.iter().map(|x| x.get_name())
     }
 
     pub fn clear(&mut self) {
-        self.branches.clear();
+        *self = Self::new();
     }
 
     fn init(&mut self, coverage: &CodeCoverage) {
         for func_cov in coverage.iter_function_covs() {
             let func_name = func_cov.get_name();
-            let func_branches = &func_cov.branches;
-            let mut branches = Vec::new();
-            for branch_state in func_branches {
-                let (true_branch, false_branch) = BranchState::from_llvm_cov(branch_state);
-                branches.push(true_branch.clear_bucket());
-                branches.push(false_branch.clear_bucket());
-            }
-            let func_branches = FuncBranches::new(branches);
-            if self.branches.contains_key(func_name) {
+            if let Some(id) = self.func_ids.get(func_name) {
+                self.order.push(*id);
                 continue;
             }
-            self.branches.insert(func_name.to_string(), func_branches);
+            let id = self.funcs.len();
+            let offset = self.branches.len();
+            for branch_state in &func_cov.branches {
+                let (true_branch, false_branch) = parse_branch(branch_state);
+                self.branches.push(true_branch);
+                self.branches.push(false_branch);
+            }
+            let len = self.branches.len() - offset;
+            self.buckets.resize(self.branches.len(), BUCKET_MASK);
+            self.funcs.push(FuncBranches {
+                name: func_name.to_string(),
+                offset,
+                len,
+            });
+            self.func_ids.insert(func_name.to_string(), id);
+            self.order.push(id);
         }
     }
 
-    pub fn has_new(&mut self, coverage: &CodeCoverage) -> HashMap<String, Vec<BranchState>> {
+    /// Look up the id of the `pos`-th function of a coverage. The hashing is only needed if the
+    /// coverage is not in the init order.
+    fn get_func_id(&self, pos: usize, func_name: &str) -> Option<usize> {
+        if let Some(id) = self.order.get(pos) {
+            if self.funcs[*id].name == func_name {
+                return Some(*id);
+            }
+        }
+        self.func_ids.get(func_name).copied()
+    }
+
+    pub fn get_func_num(&self) -> usize {
+        self.funcs.len()
+    }
+
+    pub fn get_func_id_by_name(&self, func_name: &str) -> Option<usize> {
+        self.func_ids.get(func_name).copied()
+    }
+
+    pub fn has_new(
+        &mut self,
+        coverage: &CodeCoverage,
+        exponent_branch: bool,
+    ) -> HashMap<String, Vec<BranchState>> {
         if self.is_empty() {
             self.init(coverage);
         }
+        self.check_new(coverage, exponent_branch)
+    }
+
+    /// Collect the new branches of `coverage` against the initialized global branches.
+    /// This only reads the global branches, thus can be called from multiple threads.
+    pub fn check_new(
+        &self,
+        coverage: &CodeCoverage,
+        exponent_branch: bool,
+    ) -> HashMap<String, Vec<BranchState>> {
+        SCRATCH.with(|scratch| {
+            let mut scratch = scratch.borrow_mut();
+            let scratch = &mut *scratch;
+            let epoch = scratch.next_epoch(self.funcs.len());
+            self.check_new_with(coverage, exponent_branch, epoch, scratch)
+        })
+    }
+
+    fn check_new_with(
+        &self,
+        coverage: &CodeCoverage,
+        exponent_branch: bool,
+        epoch: u32,
+        scratch: &mut CheckScratch,
+    ) -> HashMap<String, Vec<BranchState>> {
+        let trace = &mut scratch.trace;
         let mut new_branches: HashMap<String, Vec<BranchState>> = HashMap::new();
-        let mut visited = HashSet::new();
-        for func in coverage.iter_function_covs() {
+        for (pos, func) in coverage.iter_function_covs().enumerate() {
             let func_name = func.get_name();
-            if visited.contains(func_name) {
+            let id = self
+                .get_func_id(pos, func_name)
+                .unwrap_or_else(|| panic!("cannot found {func_name} in branch"));
+            if scratch.visited[id] == epoch {
                 continue;
             }
-            visited.insert(func_name);
-            let func_states = llvm_branches_to_internal(&func.branches);
-            let global_states = self
-                .branches
-                .get(func_name)
-                .unwrap_or_else(|| panic!("cannot found {func_name} in branch"));
-            let has_new = Self::check_branch_states(global_states, &func_states);
+            scratch.visited[id] = epoch;
+            // an unexecuted function has no hit branch.
+            if func.count == 0 {
+                continue;
+            }
+            llvm_branches_to_buckets(&func.branches, trace);
+            let range = self.funcs[id].range();
+            let global_buckets = &self.buckets[range.clone()];
+            assert_eq!(global_buckets.len(), trace.len());
+            if !Self::check_buckets(global_buckets, trace, exponent_branch) {
+                continue;
+            }
+            let has_new = Self::check_branch_states(
+                &self.branches[range],
+                global_buckets,
+                trace,
+                exponent_branch,
+            );
+            new_branches.insert(func_name.to_string(), has_new);
+        }
+        new_branches
+    }
+
+    /// Collect the branches hit by `coverage`, with their buckets and positions. They are all that
+    /// `check_hits` needs of a coverage, and far fewer than the branches the coverage holds.
+    pub fn get_hit_branches(
+        &mut self,
+        coverage: &CodeCoverage,
+    ) -> HashMap<String, Vec<BranchState>> {
+        if self.is_empty() {
+            self.init(coverage);
+        }
+        SCRATCH.with(|scratch| {
+            let mut scratch = scratch.borrow_mut();
+            let scratch = &mut *scratch;
+            let epoch = scratch.next_epoch(self.funcs.len());
+            let mut hits: HashMap<String, Vec<BranchState>> = HashMap::new();
+            for (pos, func) in coverage.iter_function_covs().enumerate() {
+                let func_name = func.get_name();
+                let id = self
+                    .get_func_id(pos, func_name)
+                    .unwrap_or_else(|| panic!("cannot found {func_name} in branch"));
+                if scratch.visited[id] == epoch {
+                    continue;
+                }
+                scratch.visited[id] = epoch;
+                if func.count == 0 {
+                    continue;
+                }
+                llvm_branches_to_buckets(&func.branches, &mut scratch.trace);
+                let branches = &self.branches[self.funcs[id].range()];
+                let states: Vec<BranchState> = scratch
+                    .trace
+                    .iter()
+                    .enumerate()
+                    .filter(|(_, bucket)| **bucket != 0)
+                    .map(|(i, bucket)| BranchState::new(branches[i], *bucket).with_index(i))
+                    .collect();
+                if !states.is_empty() {
+                    hits.insert(func_name.to_string(), states);
+                }
+            }
+            hits
+        })
+    }
+
+    /// Collect the new branches among the hits from `get_hit_branches`, which is the same as
+    /// `check_new` on the coverage they are taken from.
+    pub fn check_hits(
+        &self,
+        hits: &HashMap<String, Vec<BranchState>>,
+        exponent_branch: bool,
+    ) -> HashMap<String, Vec<BranchState>> {
+        let mut new_branches: HashMap<String, Vec<BranchState>> = HashMap::new();
+        for (func, states) in hits {
+            let Some(id) = self.func_ids.get(func) else {
+                continue;
+            };
+            let range = self.funcs[*id].range();
+            let has_new: Vec<BranchState> = states
+                .iter()
+                .filter(|state| {
+                    let pos = range.start + state.index;
+                    let global_state = BranchState::new(self.branches[pos], self.buckets[pos]);
+                    global_state.check_new(state, exponent_branch)
+                })
+                .cloned()
+                .collect();
             if !has_new.is_empty() {
-                new_branches.insert(func_name.to_string(), has_new);
+                new_branches.insert(func.clone(), has_new);
             }
         }
         new_branches
@@ -203,209 +380,276 @@ impl GlobalBranches {
 
     pub fn merge(&mut self, new_branches: &HashMap<String, Vec<BranchState>>) {
         for (func, new_branches) in new_branches.iter() {
-            if let Some(global_states) = self.branches.get_mut(func) {
-                Self::merge_branch_states(global_states, new_branches);
+            if let Some(id) = self.func_ids.get(func) {
+                let range = self.funcs[*id].range();
+                Self::merge_branch_states(
+                    &self.branches[range.clone()],
+                    &mut self.buckets[range],
+                    new_branches,
+                );
             }
         }
     }
 
+    /// Whether the trace hits any new bucket. There is no early exit in the loop so that it can be vectorized.
+    pub fn check_buckets(
+        global_buckets: &[BucketType],
+        trace: &[BucketType],
+        exponent_branch: bool,
+    ) -> bool {
+        if exponent_branch {
+            global_buckets
+                .iter()
+                .zip(trace)
+                .fold(0, |acc, (global, bucket)| acc | (global & bucket))
+                != 0
+        } else {
+            global_buckets
+                .iter()
+                .zip(trace)
+                .fold(false, |acc, (global, bucket)| {
+                    acc | ((*global == BUCKET_MASK) & (*bucket != 0))
+                })
+        }
+    }
+
+    /// Collect the branches hit new buckets, with their positions for the later merge.
     pub fn check_branch_states(
-        global_states: &FuncBranches,
-        func_branches: &[BranchState],
+        branches: &[Branch],
+        global_buckets: &[BucketType],
+        trace: &[BucketType],
+        exponent_branch: bool,
     ) -> Vec<BranchState> {
-        let global_states = global_states.get_branches();
-        assert_eq!(global_states.len(), func_branches.len());
-
         let mut new_branches: Vec<BranchState> = Vec::new();
-        let branch_len = global_states.len();
-        for i in 0..branch_len {
-            let global_state = &global_states[i];
-            let func_state = &func_branches[i];
-            let has_new = global_state.check_new(func_state);
+        for i in 0..global_buckets.len() {
+            let global_state = BranchState::new(branches[i], global_buckets[i]);
+            let func_state = BranchState::new(branches[i], trace[i]).with_index(i);
+            let has_new = if exponent_branch {
+                global_state.check_exponential_new(func_state.bucket)
+            } else {
+                global_state.check_absolute_new(func_state.bucket)
+            };
             if has_new {
-                new_branches.push(func_state.clone());
+                new_branches.push(func_state);
             }
         }
         new_branches
     }
 
-    pub fn merge_branch_states(global_states: &mut FuncBranches, new_branches: &Vec<BranchState>) {
-        for global_state in global_states.get_branches_mut() {
-            let global_branch = global_state.get_branch();
-            for func_state in new_branches {
-                let func_branch = func_state.get_branch();
-                if global_branch == func_branch {
-                    global_state.merge(func_state)
-                }
-            }
+    /// Merge the new branches by the positions from `check_branch_states`, in O(k) of the new ones.
+    pub fn merge_branch_states(
+        branches: &[Branch],
+        global_buckets: &mut [BucketType],
+        new_branches: &Vec<BranchState>,
+    ) {
+        for func_state in new_branches {
+            #[cfg(test)]
+            MERGE_VISITS.with(|visits| visits.set(visits.get() + 1));
+            debug_assert_eq!(branches[func_state.index], func_state.branch);
+            global_buckets[func_state.index] &= !func_state.bucket;
         }
     }
 
     pub fn compute_branch_coverage(&self) -> (usize, usize) {
-        let mut covered_branch = 0;
-        let mut total_branch = 0;
-        for func_state in self.branches.values() {
-            for branch_state in func_state.get_branches() {
-                if branch_state.bucket != BUCKET_MASK {
-                    covered_branch += 1;
-                }
-                total_branch += 1;
-            }
-        }
-        (covered_branch, total_branch)
+        let covered_branch = self.buckets.iter().filter(|x| **x != BUCKET_MASK).count();
+        (covered_branch, self.buckets.len())
     }
 
     pub fn get_covered_branch(&self) -> Vec<Branch> {
-        let mut covered = Vec::new();
-        for func_state in self.branches.values() {
-            for branch_state in func_state.get_branches() {
-                if branch_state.bucket != BUCKET_MASK {
-                    covered.push(branch_state.branch);
-                }
-            }
-        }
-        covered
+        self.branches
+            .iter()
+            .zip(self.buckets.iter())
+            .filter(|(_, bucket)| **bucket != BUCKET_MASK)
+            .map(|(branch, _)| *branch)
+            .collect()
     }
 
-    pub fn compute_func_branch_status(&self, func: &str) -> (u32, u32) {
-        if let Some(func_branch) = self.branches.get(func) {
-            return func_branch.get_branch_status();
-        }
-        (0, 0)
+    pub fn compute_func_branch_status_by_id(&self, id: usize) -> (u32, u32) {
+        let buckets = &self.buckets[self.funcs[id].range()];
+        let covered = buckets.iter().filter(|x| **x != BUCKET_MASK).count();
+        (covered as u32, buckets.len() as u32)
     }
 
-    /// compute the recursive code coverage inside a function
-    pub fn compute_recursive_func_coverage(
-        &self,
-        func: &str,
-        cov_cache: &HashMap<String, (u32, u32)>,
-    ) -> eyre::Result<f32> {
-        if let Some((covered, total)) = cov_cache.get(func) {
-            if covered == &0 && total != &0 {
-                return Ok(0_f32);
-            }
-        }
-        let mut visited = HashSet::new();
-        let (covered_branches, total_branches) =
-            self.get_func_branch_coverage(func, cov_cache, &mut visited)?;
+    /// The coverage rate of the branches reachable from `func`. If there is no branch,
+    /// it is decided by whether `func` has been executed.
+    pub fn compute_coverage_rate(func: &str, covered_branches: u32, total_branches: u32) -> f32 {
         if total_branches == 0 {
             if let Some(exec_count) = get_exec_counter_value(func) {
                 if exec_count == 0 {
-                    return Ok(0_f32);
+                    return 0_f32;
                 } else {
-                    return Ok(1_f32);
+                    return 1_f32;
                 }
             }
-            return Ok(0_f32);
-        }
-        let func_coverage = covered_branches as f32 / total_branches as f32;
-        Ok(func_coverage)
-    }
-
-    fn get_func_branch_coverage(
-        &self,
-        func: &str,
-        cov_cache: &HashMap<String, (u32, u32)>,
-        visited: &mut HashSet<String>,
-    ) -> eyre::Result<(u32, u32)> {
-        visited.insert(func.to_string());
-        if let Some((func_covered, func_total)) = cov_cache.get(func) {
-            let callees = get_lib_call_graph().get_direct_callees(func);
-            let (callee_covered, callee_total) =
-                self.compute_callees_branch_coverage(callees, cov_cache, visited)?;
-            let branch = (func_covered + callee_covered, func_total + callee_total);
-            return Ok(branch);
-        }
-        // for standard library apis, directly return zeros.
-        Ok((0, 0))
-    }
-
-    /// compute the branch coverage for all callees. visited is avoid to count the coverage for duplicated calles, each callee only count once.
-    fn compute_callees_branch_coverage(
-        &self,
-        callees: Vec<&str>,
-        cov_cache: &HashMap<String, (u32, u32)>,
-        visited: &mut HashSet<String>,
-    ) -> eyre::Result<(u32, u32)> {
-        let mut covered_branches = 0_u32;
-        let mut num_branches = 0_u32;
-        for callee in callees {
-            if visited.contains(callee) {
-                continue;
-            }
-            let (covered, total) = self.get_func_branch_coverage(callee, cov_cache, visited)?;
-            covered_branches += covered;
-            num_branches += total;
+            return 0_f32;
         }
-        let branch = (covered_branches, num_branches);
-        Ok(branch)
+        covered_branches as f32 / total_branches as f32
     }
 }
 
-fn llvm_branches_to_internal(llvm_branches: &Vec<CovBranch>) -> Vec<BranchState> {
-    let mut func_branches = Vec::new();
+/// Write the buckets of the true and false branches of each llvm branch into `trace`.
+fn llvm_branches_to_buckets(llvm_branches: &[CovBranch], trace: &mut Vec<BucketType>) {
+    trace.clear();
     for llvm_branch in llvm_branches {
-        let (true_branch, false_branch) = BranchState::from_llvm_cov(llvm_branch);
-        func_branches.push(true_branch);
-        func_branches.push(false_branch);
+        trace.push(BranchState::calculate_bucket_count(llvm_branch[4]));
+        trace.push(BranchState::calculate_bucket_count(llvm_branch[5]));
     }
-    func_branches
 }
 
 #[cfg(test)]
 mod tests {
 
-    use crate::config::CONFIG_INSTANCE;
-
     use super::*;
+    use std::collections::HashSet;
 
     #[test]
     fn test_absolute_new_branch() {
-        crate::config::Config::init_test("cJSON");
-        let mut config = CONFIG_INSTANCE.get().unwrap().write().unwrap();
-        config.exponent_branch = false;
-
+        let exponent_branch = false;
         let branch: Branch = [0, 0, 0, 0, 0, 0, 0, 0];
         let mut global_branch = BranchState::new(branch, BUCKET_MASK);
         let exec_count = 10;
         let bucket = BranchState::calculate_bucket_count(exec_count);
         let trace_state: BranchState = BranchState::new(branch, bucket);
-        let has_new = global_branch.check_new(&trace_state);
+        let has_new = global_branch.check_new(&trace_state, exponent_branch);
         assert!(has_new);
 
         global_branch.merge(&trace_state);
-        let has_new = global_branch.check_new(&trace_state);
+        let has_new = global_branch.check_new(&trace_state, exponent_branch);
         assert!(!has_new);
 
         let exec_count = 20;
         let bucket = BranchState::calculate_bucket_count(exec_count);
         let trace_state: BranchState = BranchState::new(branch, bucket);
-        let has_new = global_branch.check_new(&trace_state);
+        let has_new = global_branch.check_new(&trace_state, exponent_branch);
         assert!(!has_new);
     }
 
     #[test]
     fn test_exponent_new_branch() {
-        crate::config::Config::init_test("cJSON");
-        let mut config = CONFIG_INSTANCE.get().unwrap().write().unwrap();
-        config.exponent_branch = true;
-
+        let exponent_branch = true;
         let branch: Branch = [0, 0, 0, 0, 0, 0, 0, 0];
         let mut global_branch = BranchState::new(branch, BUCKET_MASK);
         let exec_count = 10;
         let bucket = BranchState::calculate_bucket_count(exec_count);
         let trace_state: BranchState = BranchState::new(branch, bucket);
-        let has_new = global_branch.check_new(&trace_state);
+        let has_new = global_branch.check_new(&trace_state, exponent_branch);
         assert!(has_new);
 
         global_branch.merge(&trace_state);
-        let has_new = global_branch.check_new(&trace_state);
+        let has_new = global_branch.check_new(&trace_state, exponent_branch);
         assert!(!has_new);
 
         let exec_count = 20;
         let bucket = BranchState::calculate_bucket_count(exec_count);
         let trace_state: BranchState = BranchState::new(branch, bucket);
-        let has_new = global_branch.check_new(&trace_state);
+        let has_new = global_branch.check_new(&trace_state, exponent_branch);
         assert!(has_new);
     }
+
+    #[test]
+    fn test_check_buckets() {
+        let global = [BUCKET_MASK, BUCKET_MASK & !1, 0];
+        let trace = [0, 1, 0];
+        assert!(!GlobalBranches::check_buckets(&global, &trace, true));
+        assert!(!GlobalBranches::check_buckets(&global, &trace, false));
+
+        let trace = [0, 2, 0];
+        assert!(GlobalBranches::check_buckets(&global, &trace, true));
+        assert!(!GlobalBranches::check_buckets(&global, &trace, false));
+
+        let trace = [1, 0, 0];
+        assert!(GlobalBranches::check_buckets(&global, &trace, true));
+        assert!(GlobalBranches::check_buckets(&global, &trace, false));
+    }
+
+    /// Mock a coverage in the size of sqlite3, which has thousands of functions and some of them
+    /// (e.g., sqlite3VdbeExec) have thousands of branches.
+    fn mock_sqlite_coverage(round: usize) -> CodeCoverage {
+        let summary = serde_json::json!({"count": 0, "covered": 0, "percent": 0.0});
+        let mut functions = Vec::new();
+        for func in 0..2000 {
+            let branch_num = if func % 400 == 0 { 4000 } else { 20 };
+            let branches: Vec<CovBranch> = (0..branch_num)
+                .map(|line| [line, 1, line, 8, line * round % 7, round % 3, func, 0, 4])
+                .collect();
+            functions.push(serde_json::json!({
+                "branches": branches,
+                "count": 1,
+                "name": format!("func_{func}"),
+            }));
+        }
+        let coverage = serde_json::json!({"data": [{
+            "functions": functions,
+            "totals": {
+                "branches": summary,
+                "functions": summary,
+                "lines": summary,
+                "regions": summary,
+            },
+        }]});
+        serde_json::from_value(coverage).unwrap()
+    }
+
+    #[test]
+    fn test_check_hits() {
+        let mut global_branches = GlobalBranches::new();
+        let first = mock_sqlite_coverage(1);
+        let new_branches = global_branches.has_new(&first, true);
+        global_branches.merge(&new_branches);
+        let coverage = mock_sqlite_coverage(2);
+        let hits = global_branches.get_hit_branches(&coverage);
+        let hit_num: usize = hits.values().map(Vec::len).sum();
+        assert!(hit_num < global_branches.buckets.len());
+        for exponent_branch in [true, false] {
+            let key = |new_branches: HashMap<String, Vec<BranchState>>| {
+                let mut keys: Vec<(String, usize, BucketType)> = new_branches
+                    .into_iter()
+                    .flat_map(|(func, states)| {
+                        states
+                            .into_iter()
+                            .map(move |x| (func.clone(), x.index, x.bucket))
+                    })
+                    .collect();
+                keys.sort();
+                keys
+            };
+            assert_eq!(
+                key(global_branches.check_hits(&hits, exponent_branch)),
+                key(global_branches.check_new(&coverage, exponent_branch))
+            );
+        }
+    }
+
+    #[test]
+    fn test_merge_sqlite_sized_branches() {
+        let coverages: Vec<CodeCoverage> = (1..6).map(mock_sqlite_coverage).collect();
+        let mut global_branches = GlobalBranches::new();
+        for coverage in &coverages {
+            let new_branches = global_branches.has_new(coverage, true);
+            // the merge goes by the positions of the new branches: each one points to its own
+            // slot, only those slots change, and no other slot is visited.
+            let new_count: usize = new_branches.values().map(Vec::len).sum();
+            let before = global_branches.buckets.clone();
+            let mut positions = HashSet::new();
+            for (func, states) in &new_branches {
+                let range = global_branches.funcs[global_branches.func_ids[func]].range();
+                for state in states {
+                    let pos = range.start + state.index;
+                    assert_eq!(global_branches.branches[pos], state.branch);
+                    positions.insert(pos);
+                }
+            }
+            MERGE_VISITS.with(|visits| visits.set(0));
+            global_branches.merge(&new_branches);
+            assert_eq!(MERGE_VISITS.with(|visits| visits.get()), new_count);
+            assert!(new_count < global_branches.buckets.len());
+            for (pos, (old, new)) in before.iter().zip(&global_branches.buckets).enumerate() {
+                assert!(old == new || positions.contains(&pos));
+            }
+            assert!(global_branches.check_new(coverage, true).is_empty());
+        }
+        let (covered, total) = global_branches.compute_branch_coverage();
+        assert_eq!(total, (5 * 4000 + 1995 * 20) * 2);
+        assert!(covered > 0 && covered < total);
+    }
 }
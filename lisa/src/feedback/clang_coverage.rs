@@ -9,7 +9,12 @@ use std::{
 };
 
 use crate::{deopt::utils::get_file_dirname, feedback::observer::Observer};
-use crate::{execution::Executor, program::serde::Deserializer};
+use crate::{
+    execution::{max_cpu_count, Executor},
+    program::serde::Deserializer,
+};
+use std::sync::mpsc::channel;
+use threadpool::ThreadPool;
 
 use super::branches::{parse_branch, Branch};
 
@@ -413,6 +418,32 @@ impl Executor {
         Ok(cov)
     }
 
+    /// Export the coverage of many profiles concurrently, and the results are in the order of `profdatas`.
+    pub fn obtain_covs_from_profdatas(&self, profdatas: &[PathBuf]) -> Result<Vec<CodeCoverage>> {
+        let pool = ThreadPool::new(max_cpu_count().min(profdatas.len()).max(1));
+        let (tx, rx) = channel();
+        for (i, profdata) in profdatas.iter().enumerate() {
+            let tx = tx.clone();
+            let executor = self.clone();
+            let profdata = profdata.clone();
+            pool.execute(move || {
+                let cov = executor.obtain_cov_from_profdata(&profdata);
+                let _ = tx.send((i, cov));
+            });
+        }
+        drop(tx);
+        let mut covs: Vec<Option<CodeCoverage>> = profdatas.iter().map(|_| None).collect();
+        for (i, cov) in rx.iter() {
+            covs[i] = Some(cov?);
+        }
+        covs.into_iter()
+            .zip(profdatas)
+            .map(|(cov, profdata)| {
+                cov.ok_or_else(|| eyre::eyre!("failed to collect code coverage from {profdata:?}"))
+            })
+            .collect()
+    }
+
     pub fn obtain_cov_summary_from_profdata(&self, profdata: &Path) -> Result<CodeCoverage> {
         // library so linked with code coverage instrumentation.
         let cov_lib = crate::deopt::utils::get_cov_lib_path(&self.deopt, true);
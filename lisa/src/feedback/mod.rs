@@ -1,4 +1,7 @@
+pub mod api_coverage;
+pub mod api_ngrams;
 pub mod branches;
 pub mod clang_coverage;
 pub mod observer;
+pub mod sampling;
 pub mod schedule;
@@ -4,13 +4,16 @@ use std::{
 };
 
 use super::{
+    api_coverage::RecursiveCoverage,
+    api_ngrams::{ApiNgram, ApiNgramSet, NgramSet},
     branches::{Branch, BranchState, GlobalBranches},
     clang_coverage::CodeCoverage,
 };
 use crate::{
     analysis::{adg::ADG, cfg::CFGBuilder},
-    config::CONFIG_INSTANCE,
+    config::get_config,
     deopt::utils::read_sort_dir,
+    execution::{max_cpu_count, Executor},
     program::{
         gadget::{get_func_gadgets, FuncGadget},
         Program,
@@ -18,14 +21,14 @@ use crate::{
     Deopt,
 };
 use eyre::Result;
-use std::collections::HashSet;
-use std::sync::{Arc, RwLock};
+use std::sync::Arc;
 
 pub struct Observer {
     pub adg: ADG,
-    pub discovered_api_triples: Arc<RwLock<HashSet<(String, String,String)>>>,
+    pub discovered_api_ngrams: Arc<ApiNgramSet>,
     deopt: Deopt,
     branches: GlobalBranches,
+    recursive_coverage: Option<RecursiveCoverage>,
     api_coverage: HashMap<String, f32>,
 }
 
@@ -35,31 +38,24 @@ impl Observer {
             adg: ADG::default(),
             deopt: deopt.clone(),
             branches: GlobalBranches::new(),
+            recursive_coverage: None,
             api_coverage: HashMap::new(),
-            discovered_api_triples: Arc::new(RwLock::new(HashSet::new())),
+            discovered_api_ngrams: Arc::new(ApiNgramSet::new()),
         }
     }
-    pub fn has_new_api_triples(&self, pairs: &[(String, String,String)]) -> bool {
-        if pairs.is_empty() {
-            return false;
-        }
+    pub fn has_new_api_ngrams(&self, ngrams: &[ApiNgram]) -> bool {
         let mut has_new = false;
-        let mut discovered_pair = self.discovered_api_triples.write().unwrap();
-        for pair in pairs {
-            if discovered_pair.insert(pair.clone()) {
+        for ngram in ngrams {
+            if self.discovered_api_ngrams.insert(*ngram) {
                 has_new = true;
             }
         }
         has_new
     }
 
-    pub fn merge_api_triples(&self, pairs: &HashSet<(String, String,String)>) {
-        if pairs.is_empty() {
-            return;
-        }
-        let mut discovered_pair = self.discovered_api_triples.write().unwrap();
-        for pair in pairs {
-            discovered_pair.insert(pair.clone());
+    pub fn merge_api_ngrams(&self, ngrams: &NgramSet) {
+        for ngram in ngrams {
+            self.discovered_api_ngrams.insert(*ngram);
         }
     }
 
@@ -69,6 +65,7 @@ impl Observer {
 
     pub fn clear_global_branches(&mut self) {
         self.branches.clear();
+        self.recursive_coverage = None;
     }
 
     pub fn get_adg(&self) -> &ADG {
@@ -117,21 +114,13 @@ impl Observer {
 
     // New branch is the branch triggers a new bucket bitmap of this branch.
     pub fn has_new_branch(&mut self, coverage: &CodeCoverage) -> HashMap<String, Vec<BranchState>> {
-        self.branches.has_new(coverage)
+        let exponent_branch = get_config().exponent_branch;
+        self.branches.has_new(coverage, exponent_branch)
     }
 
     // Unique branch is the branch that have not been triggered before.
     pub fn has_unique_branch(&mut self, coverage: &CodeCoverage) -> HashMap<String, Vec<Branch>> {
-        {
-            let mut config = CONFIG_INSTANCE.get().unwrap().write().unwrap();
-            config.exponent_branch = false;
-        }
-
-        let unique_branche_states = self.branches.has_new(coverage);
-        {
-            let mut config = CONFIG_INSTANCE.get().unwrap().write().unwrap();
-            config.exponent_branch = true;
-        }
+        let unique_branche_states = self.branches.has_new(coverage, false);
         let mut unique_branches: HashMap<String, Vec<Branch>> = HashMap::new();
         for (func, branch_states) in unique_branche_states {
             let branches: Vec<Branch> = branch_states
@@ -143,6 +132,24 @@ impl Observer {
         unique_branches
     }
 
+    /// The branches hit by `coverage`, which is all that `has_new_hit` needs to keep of it.
+    pub fn get_hit_branches(
+        &mut self,
+        coverage: &CodeCoverage,
+    ) -> HashMap<String, Vec<BranchState>> {
+        self.branches.get_hit_branches(coverage)
+    }
+
+    /// `has_new_branch` on the hit branches of a coverage. Without `exponent_branch`, only the
+    /// branches never triggered before are new, as in `has_unique_branch`.
+    pub fn has_new_hit(
+        &self,
+        hits: &HashMap<String, Vec<BranchState>>,
+        exponent_branch: bool,
+    ) -> HashMap<String, Vec<BranchState>> {
+        self.branches.check_hits(hits, exponent_branch)
+    }
+
     pub fn merge_new_branch(&mut self, new_branches: &HashMap<String, Vec<BranchState>>) {
         self.branches.merge(new_branches)
     }
@@ -162,18 +169,27 @@ impl Observer {
 
     pub fn compute_library_api_coverage(&mut self) -> Result<&HashMap<String, f32>> {
         self.api_coverage.clear();
-        let mut cov_cache: HashMap<String, (u32, u32)> = HashMap::new();
-        for func_name in self.get_global_branches().get_entity().keys() {
-            let (covered, total) = self
-                .get_global_branches()
-                .compute_func_branch_status(func_name);
-            cov_cache.insert(func_name.to_string(), (covered, total));
+        // the call graph is condensed once the global branches are initialized.
+        let func_num = self.branches.get_func_num();
+        if self.recursive_coverage.as_ref().map(|x| x.get_func_num()) != Some(func_num) {
+            self.recursive_coverage = Some(RecursiveCoverage::from_global_branches(&self.branches));
         }
+        let recursive_coverage = self.recursive_coverage.as_mut().unwrap();
+        recursive_coverage.update_from_global_branches(&self.branches);
         for gadget in get_func_gadgets() {
             let func = gadget.get_func_name();
-            let api_cov = self
-                .get_global_branches()
-                .compute_recursive_func_coverage(func, &cov_cache)?;
+            let api_cov = match self.branches.get_func_id_by_name(func) {
+                Some(id) => {
+                    let (covered, total) = recursive_coverage.get_func_status(id);
+                    if covered == 0 && total != 0 {
+                        0_f32
+                    } else {
+                        let (covered, total) = recursive_coverage.get_recursive_status(id);
+                        GlobalBranches::compute_coverage_rate(func, covered, total)
+                    }
+                }
+                None => GlobalBranches::compute_coverage_rate(func, 0, 0),
+            };
             self.api_coverage.insert(func.to_string(), api_cov);
         }
         Ok(&self.api_coverage)
@@ -245,25 +261,32 @@ impl Observer {
     }
 
     pub fn compute_coverage_for_program(program: usize, deopt: &Deopt) -> Result<f32> {
-        let mut observer = Observer::new(deopt);
         let coverage = deopt.get_seed_coverage(program)?;
-        let new_branches = observer.has_new_branch(&coverage);
+        Ok(Self::compute_coverage_rate(&coverage, deopt))
+    }
+
+    pub fn compute_coverage_rate(coverage: &CodeCoverage, deopt: &Deopt) -> f32 {
+        let mut observer = Observer::new(deopt);
+        let new_branches = observer.has_new_branch(coverage);
         if !new_branches.is_empty() {
             observer.merge_new_branch(&new_branches);
         }
         let (covered_branch, total_branch) = observer.branches.compute_branch_coverage();
         let cover_rate: f32 = covered_branch as f32 / total_branch as f32;
-        Ok(cover_rate)
+        cover_rate
     }
 
     pub fn sync_from_previous(deopt: &mut Deopt) -> Result<Self> {
         let mut observer = Observer::new(deopt);
         deopt.load_programs_from_seeds()?;
-        for program in deopt.seed_queue.iter() {
-            let coverage = deopt.get_seed_coverage(program.id)?;
-            let new_branches = observer.has_new_branch(&coverage);
-            if !new_branches.is_empty() {
-                observer.merge_new_branch(&new_branches);
+        let seed_ids: Vec<usize> = deopt.seed_queue.iter().map(|x| x.id).collect();
+        let executor = Executor::new(deopt)?;
+        for chunk in seed_ids.chunks(max_cpu_count()) {
+            for coverage in deopt.get_seeds_coverage(&executor, chunk)? {
+                let new_branches = observer.has_new_branch(&coverage);
+                if !new_branches.is_empty() {
+                    observer.merge_new_branch(&new_branches);
+                }
             }
         }
         log::info!("{}", observer.dump_global_states());
@@ -280,15 +303,23 @@ impl Observer {
         self.clear_global_branches();
 
         let seed_dir = self.deopt.get_library_seed_dir()?;
-        for seed in read_sort_dir(&seed_dir)? {
-            let mut program = Program::load_from_path(&seed)?;
-            let coverage = self.deopt.get_seed_coverage(program.id)?;
-            let unique_branches = self.has_unique_branch(&coverage);
-            if !unique_branches.is_empty() {
-                program.set_unique_branches(unique_branches);
-                self.merge_coverage(&coverage);
-                // update the quality
-                self.deopt.save_program(&program)?;
+        let seeds = read_sort_dir(&seed_dir)?;
+        let executor = Executor::new(&self.deopt)?;
+        for chunk in seeds.chunks(max_cpu_count()) {
+            let mut programs = Vec::new();
+            for seed in chunk {
+                programs.push(Program::load_from_path(seed)?);
+            }
+            let seed_ids: Vec<usize> = programs.iter().map(|x| x.id).collect();
+            let coverages = self.deopt.get_seeds_coverage(&executor, &seed_ids)?;
+            for (mut program, coverage) in programs.into_iter().zip(coverages) {
+                let unique_branches = self.has_unique_branch(&coverage);
+                if !unique_branches.is_empty() {
+                    program.set_unique_branches(unique_branches);
+                    self.merge_coverage(&coverage);
+                    // update the quality
+                    self.deopt.save_program(&program)?;
+                }
             }
         }
         log::info!("Recompute finished. Current: {}", self.dump_global_states());
@@ -0,0 +1,181 @@
+//! A feedback controller of the sampling parameters of LLM requests in ApiCombination mode.
+//! It sizes the number of samples and the temperature of the next request from the recent
+//! success and novelty rates of the chosen APIs, to gain more new API n-grams per output token.
+use std::collections::HashMap;
+
+use crate::{
+    config::get_config,
+    program::gadget::FuncGadget,
+    request::{get_completion_tokens, get_mean_completion_tokens, prompt::Prompt},
+};
+
+/// The smoothing factor of the moving averages of each API.
+const EWMA_ALPHA: f32 = 0.3;
+/// The maximum of samples per request, as limited by the `n` of the chat API.
+const MAX_SAMPLES: u8 = 128;
+/// The range of the temperature relative to the default one of the handler.
+const MIN_TEMPERATURE_SCALE: f32 = 0.6;
+const MAX_TEMPERATURE_SCALE: f32 = 1.4;
+
+/// The recent outcomes of the programs that use an API.
+#[derive(Debug, Clone, Copy)]
+struct ApiStat {
+    /// The ratio of programs passing the sanitization.
+    succ_rate: f32,
+    /// The new n-grams found per generated program.
+    novelty: f32,
+}
+
+#[derive(Debug, Default)]
+pub struct SamplingController {
+    stats: HashMap<&'static str, ApiStat>,
+    programs: usize,
+    succ: usize,
+    new_ngrams: usize,
+}
+
+impl SamplingController {
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    /// The outcome rates over all rounds, which are the priors of the APIs never prompted.
+    fn get_global_stat(&self) -> ApiStat {
+        if self.programs == 0 {
+            return ApiStat {
+                succ_rate: 1.0,
+                novelty: 1.0,
+            };
+        }
+        ApiStat {
+            succ_rate: self.succ as f32 / self.programs as f32,
+            novelty: self.new_ngrams as f32 / self.programs as f32,
+        }
+    }
+
+    fn get_combination_stat(&self, combination: &[&FuncGadget]) -> ApiStat {
+        let global = self.get_global_stat();
+        if combination.is_empty() {
+            return global;
+        }
+        let mut sum = ApiStat {
+            succ_rate: 0.0,
+            novelty: 0.0,
+        };
+        for func in combination {
+            let stat = self.stats.get(func.get_func_name()).unwrap_or(&global);
+            sum.succ_rate += stat.succ_rate;
+            sum.novelty += stat.novelty;
+        }
+        let len = combination.len() as f32;
+        ApiStat {
+            succ_rate: sum.succ_rate / len,
+            novelty: sum.novelty / len,
+        }
+    }
+
+    /// Decide the number of samples and the temperature of the next request of the prompt.
+    /// Combinations that keep failing get fewer and more conservative samples, the productive
+    /// ones get more, and the ones passing without new n-grams get a higher temperature.
+    /// The temperature is scaled from `default_temperature`, which the handler samples at
+    /// if the prompt does not set one.
+    pub fn configure(&self, prompt: &mut Prompt, default_temperature: f32) {
+        let config = get_config();
+        let base_n = config.n_sample.max(1);
+        let global = self.get_global_stat();
+        let comb = self.get_combination_stat(&prompt.gadgets);
+
+        let yield_ratio = if global.novelty > 0.0 {
+            comb.novelty / global.novelty
+        } else {
+            comb.succ_rate / global.succ_rate.max(f32::EPSILON)
+        };
+        let mut n = (base_n as f32 * yield_ratio).round() as usize;
+        n = n.clamp(1, (base_n as usize * 2).min(MAX_SAMPLES as usize));
+        if config.round_token_budget > 0 {
+            if let Some(tokens) = get_mean_completion_tokens() {
+                let affordable = (config.round_token_budget as f32 / tokens) as usize;
+                n = n.min(affordable.max(1));
+            }
+        }
+
+        let novelty_ratio = if global.novelty > 0.0 {
+            (comb.novelty / global.novelty).min(1.0)
+        } else {
+            1.0
+        };
+        let scale = MIN_TEMPERATURE_SCALE
+            + (1.0 - MIN_TEMPERATURE_SCALE) * comb.succ_rate
+            + (MAX_TEMPERATURE_SCALE - 1.0) * comb.succ_rate * (1.0 - novelty_ratio);
+        let temperature = (default_temperature * scale).clamp(0.0, 2.0);
+
+        log::debug!(
+            "sampling: n: {n}, temperature: {temperature:.2}, succ_rate: {:.2}, novelty: {:.2}",
+            comb.succ_rate,
+            comb.novelty
+        );
+        prompt.n_sample = n as u8;
+        prompt.temperature = Some(temperature);
+    }
+
+    /// Update the rates of the APIs in the combination with the outcome of a round.
+    pub fn update(
+        &mut self,
+        combination: &[&'static FuncGadget],
+        programs: usize,
+        succ: usize,
+        new_ngrams: usize,
+    ) {
+        if programs == 0 {
+            return;
+        }
+        self.programs += programs;
+        self.succ += succ;
+        self.new_ngrams += new_ngrams;
+        let global = self.get_global_stat();
+        let succ_rate = succ as f32 / programs as f32;
+        let novelty = new_ngrams as f32 / programs as f32;
+        for func in combination {
+            let stat = self.stats.entry(func.get_func_name()).or_insert(global);
+            stat.succ_rate += EWMA_ALPHA * (succ_rate - stat.succ_rate);
+            stat.novelty += EWMA_ALPHA * (novelty - stat.novelty);
+        }
+    }
+
+    /// The new n-grams found per 1k output tokens of all requests, including plans and repairs.
+    pub fn get_ngrams_per_1k_tokens(&self) -> Option<f32> {
+        let tokens = get_completion_tokens();
+        if tokens == 0 {
+            return None;
+        }
+        Some(self.new_ngrams as f32 * 1000.0 / tokens as f32)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::program::gadget::get_func_gadgets;
+
+    #[test]
+    fn test_sampling_controller() {
+        crate::config::Config::init_test("cJSON");
+        let gadgets = get_func_gadgets();
+        let productive = vec![&gadgets[0]];
+        let failing = vec![&gadgets[1]];
+        let mut controller = SamplingController::new();
+        for _ in 0..5 {
+            controller.update(&productive, 10, 8, 20);
+            controller.update(&failing, 10, 0, 0);
+        }
+        let default_temperature = 0.7;
+        let mut prompt = Prompt::new(productive);
+        controller.configure(&mut prompt, default_temperature);
+        let productive_n = prompt.n_sample;
+        prompt.gadgets = failing;
+        controller.configure(&mut prompt, default_temperature);
+        assert!(productive_n > prompt.n_sample);
+        assert!(prompt.n_sample >= 1);
+        assert!(prompt.temperature.unwrap() < default_temperature);
+    }
+}
@@ -1,12 +1,14 @@
-use std::{collections::HashMap, collections::HashSet, f32::consts::E};
+use std::{collections::HashMap, f32::consts::E};
 
 use petgraph::algo;
+use rand::Rng;
 
+use super::api_ngrams::{get_ngram_names, NgramSet};
 use crate::{
     deopt::Deopt, minimize, mutation::mutate_prompt, program::{
         gadget::{FuncGadget, get_func_gadget, get_func_gadgets},
         get_exec_counter_value, load_exec_counter,
-        rand::{prob_coin, rand_comb_len, weighted_choose},
+        rand::{get_global_rng, prob_coin, rand_comb_len, weighted_choose, WeightedSampler},
         set_exec_counter_value,
     }, request::prompt::{
         Prompt, get_prompt_counter_value, load_prompt_counter, set_prompt_counter_value
@@ -80,7 +82,10 @@ fn should_deterministic_mutate(deopt: &Deopt) -> bool {
 }
 
 pub struct Schedule {
-    seeds: HashMap<String, Seed>,
+    seeds: Vec<Seed>,
+    seed_ids: HashMap<String, usize>,
+    /// The sampler over the sampling weights of seeds, rebuilt once the energies are updated.
+    sampler: WeightedSampler,
     exponent: u32,
     pub loop_count:u32
 }
@@ -94,7 +99,9 @@ impl Default for Schedule {
 impl Schedule {
     pub fn new() -> Self {
         Self {
-            seeds: HashMap::new(),
+            seeds: Vec::new(),
+            seed_ids: HashMap::new(),
+            sampler: WeightedSampler::default(),
             exponent: 1,
             loop_count: 0,
         }
@@ -103,7 +110,26 @@ impl Schedule {
         self.loop_count += 1;
     }
     pub fn get_seed_by_name(&self, name: &str) -> Option<&Seed> {
-        self.seeds.get(name)
+        self.seed_ids.get(name).map(|idx| &self.seeds[*idx])
+    }
+
+    fn get_seed_by_name_mut(&mut self, name: &str) -> Option<&mut Seed> {
+        self.seed_ids.get(name).map(|idx| &mut self.seeds[*idx])
+    }
+
+    fn set_seeds(&mut self, seeds: Vec<Seed>) {
+        self.seed_ids = seeds
+            .iter()
+            .enumerate()
+            .map(|(idx, seed)| (seed.name.clone(), idx))
+            .collect();
+        self.seeds = seeds;
+        self.rebuild_sampler();
+    }
+
+    fn rebuild_sampler(&mut self) {
+        let weights: Vec<f32> = self.seeds.iter().map(|x| x.sampling_weight).collect();
+        self.sampler = WeightedSampler::new(&weights);
     }
 
     pub fn snyc_from_str(deopt: &Deopt) {
@@ -118,25 +144,26 @@ impl Schedule {
     }
     //initial the energies for API mode
     pub fn initialize_energies_for_api_mode(&mut self) {
-        self.seeds.clear();
+        let mut seeds = Vec::new();
         for gadget in get_func_gadgets() {
             let api_name = gadget.get_func_name();
-            let seed = Seed::new_for_api_mode(api_name);
-            self.seeds.insert(api_name.to_string(), seed);
+            seeds.push(Seed::new_for_api_mode(api_name));
         }
+        self.set_seeds(seeds);
     }
     // Compute the energy for each library API. The high energy means the high probablity to be choosed in prompt.
     pub fn update_energies(&mut self, api_coverage: &HashMap<String, f32>) {
-        self.seeds.clear();
+        let mut seeds = Vec::new();
         for gadget in get_func_gadgets() {
             let api_name = gadget.get_func_name();
             let coverage = api_coverage.get(api_name).unwrap();
             let prompt_count = get_prompt_counter_value(api_name).unwrap_or(0);
             let exec_count = get_exec_counter_value(api_name).unwrap_or(0);
             let seed = Seed::new(api_name, *coverage, exec_count, prompt_count, self.exponent);
-            self.seeds.insert(api_name.to_string(), seed);
+            seeds.push(seed);
         }
-        let energies_str: Vec<f32> = self.seeds.values().map(|x| x.energy).collect();
+        self.set_seeds(seeds);
+        let energies_str: Vec<f32> = self.seeds.iter().map(|x| x.energy).collect();
         log::debug!(
             "energies: {}",
             serde_json::to_string(&energies_str).unwrap()
@@ -144,23 +171,23 @@ impl Schedule {
     }
     pub fn energy_normalization_for_one_seed(&mut self, seed: &Seed)->f32  {
         let current_energy=seed.energy;
-        let max_energy= self.seeds.values().map(|x| x.energy).fold(f32::MIN, f32::max);
-        let min_energy= self.seeds.values().map(|x| x.energy).fold(f32::MAX, f32::min);
+        let max_energy= self.seeds.iter().map(|x| x.energy).fold(f32::MIN, f32::max);
+        let min_energy= self.seeds.iter().map(|x| x.energy).fold(f32::MAX, f32::min);
         let normalized_energy=(current_energy - min_energy)/(max_energy - min_energy);
 
         normalized_energy
     }
     pub fn energy_normalization(&mut self,epsilon:f32) {
 
-        let max_energy = self.seeds.values().map(|x| x.energy).fold(f32::MIN, f32::max);
-        let min_energy = self.seeds.values().map(|x| x.energy).fold(f32::MAX, f32::min);
-        for seed in self.seeds.values_mut() {
+        let max_energy = self.seeds.iter().map(|x| x.energy).fold(f32::MIN, f32::max);
+        let min_energy = self.seeds.iter().map(|x| x.energy).fold(f32::MAX, f32::min);
+        for seed in self.seeds.iter_mut() {
             let current_energy = seed.energy;
             seed.sampling_weight = epsilon+(1_f32-epsilon)*(current_energy - min_energy) / (max_energy - min_energy);
         }
     }
     pub fn energy_condense(&mut self,num:f32) {
-        for seed in self.seeds.values_mut() {
+        for seed in self.seeds.iter_mut() {
             seed.sampling_weight = seed.sampling_weight.powf(num);
         }
 
@@ -172,14 +199,14 @@ impl Schedule {
         if n == 0.0 {
             return 0.0; 
         }
-        let sum_energy: f32 = self.seeds.values().map(|x| x.sampling_weight).sum();
+        let sum_energy: f32 = self.seeds.iter().map(|x| x.sampling_weight).sum();
         let mean = sum_energy / n;
 
         if mean == 0.0 {
             return 0.0; 
         }
         // (1/N) * sum((E - mu)^2)
-        let variance = self.seeds.values()
+        let variance = self.seeds.iter()
             .map(|x| (x.sampling_weight - mean).powi(2)) 
             .sum::<f32>() / n;
 
@@ -193,25 +220,20 @@ impl Schedule {
         alpha_min + (1.0 - alpha_min) * (-s_t).exp()
     }
 
-    pub fn update_energies_from_api_pairs(&mut self, api_pairs: &HashSet<(String, String,String)>) {
+    pub fn update_energies_from_api_pairs(&mut self, api_pairs: &NgramSet) {
         if api_pairs.is_empty() {
             log::warn!("No API pairs found to update energies.");
             return;
         }
-        for (api1, api2,api3) in api_pairs {
-            if let Some(seed) = self.seeds.get_mut(api1) {
-                seed.energy += 1.0;
-            
-            }
-            if let Some(seed) = self.seeds.get_mut(api2) {
-                seed.energy += 1.0;
-            }
-            if let Some(seed) = self.seeds.get_mut(api3) {
-                seed.energy += 1.0;
+        for ngram in api_pairs {
+            for api in get_ngram_names(*ngram) {
+                if let Some(seed) = self.get_seed_by_name_mut(api) {
+                    seed.energy += 1.0;
+                }
             }
         }
         log::debug!("Updated energies from API pairs: {}", api_pairs.len());
-        let energies_str: Vec<f32> = self.seeds.values().map(|x| x.energy).collect();
+        let energies_str: Vec<f32> = self.seeds.iter().map(|x| x.energy).collect();
         
         log::debug!(
             "energies: {}",
@@ -222,7 +244,8 @@ impl Schedule {
         let s_t=self.calculate_energy_skewness();
         let alpha_t=Schedule::calculate_alpha_t(0.5_f32,s_t);
         self.energy_condense(alpha_t);
-        let sample_str: Vec<f32> = self.seeds.values().map(|x| x.sampling_weight).collect();
+        self.rebuild_sampler();
+        let sample_str: Vec<f32> = self.seeds.iter().map(|x| x.sampling_weight).collect();
         log::debug!(
             "sampling weights: {}",
             serde_json::to_string(&sample_str).unwrap()
@@ -268,18 +291,11 @@ impl Schedule {
     pub fn assemble_high_energy_combiantion(&self) -> Vec<&'static FuncGadget> {
         log::info!("random assemble new prompt combination with their engies.");
         let len = rand_comb_len();
-        let mut comb: Vec<&str> = Vec::new();
         let mut gadgets = Vec::new();
-        while comb.len() < len {
-            let api = self.choose_api_by_energy();
-            if comb.contains(&api) {
-                continue;
-            }
-            // 打印本次选中的API及其能量
-            if let Some(seed) = self.seeds.get(api) {
+        for api in self.choose_apis_by_energy(len, &[]) {
+            if let Some(seed) = self.get_seed_by_name(api) {
                 log::info!("choose api: {} energy: {}", api, seed.energy);
             }
-            comb.push(api);
             let gadget =
                 get_func_gadget(api).unwrap_or_else(|| panic!("cannot found api {api} in gadgets"));
             gadgets.push(gadget);
@@ -288,23 +304,31 @@ impl Schedule {
         gadgets
     }
 
+    /// Choose `num` distinct APIs by their sampling weights, which are not in `excluded`.
+    pub fn choose_apis_by_energy(&self, num: usize, excluded: &[String]) -> Vec<&str> {
+        let excluded: Vec<usize> = excluded
+            .iter()
+            .filter_map(|x| self.seed_ids.get(x).copied())
+            .collect();
+        self.sampler
+            .sample_distinct(num, &excluded)
+            .into_iter()
+            .map(|idx| self.seeds[idx].name.as_str())
+            .collect()
+    }
+
     pub fn choose_api_by_energy(&self) -> &str {
-        let values: Vec<&Seed> = self.seeds.values().collect();
-        let energies: Vec<f32> = values.iter().map(|x| x.sampling_weight).collect();
-        let choose = weighted_choose(energies);
-        let mut choose_seed = values[choose];
-        
-  
+        let mut choose_seed = &self.seeds[self.sampler.sample()];
+
         let max_prob = 0.3_f32;
         let steepness = 0.1_f32; 
         let midpoint = 50.0_f32; 
-        println!("loop count: {}", self.loop_count);
       //  let replace_with_lowest_prob = max_prob / (1.0 + E.powf(steepness * (self.loop_count as f32 - midpoint)));
         let replace_with_lowest_prob = 0_f32;
         
         if prob_coin(replace_with_lowest_prob) {
             let mut min_energy = f32::MAX;
-            for seed in &values {
+            for seed in &self.seeds {
                 if seed.energy < min_energy {
                     min_energy = seed.energy;
                     choose_seed = seed;
@@ -320,8 +344,7 @@ impl Schedule {
         let mut energies: Vec<f32> = Vec::new();
         for api_name in combination {
             let energy = self
-                .seeds
-                .get(api_name)
+                .get_seed_by_name(api_name)
                 .unwrap_or_else(|| panic!("no seed named {api_name} in Schedule"))
                 .energy;
             energies.push(energy);
@@ -334,7 +357,7 @@ pub fn rand_choose_combination(len: usize) -> Vec<&'static FuncGadget> {
     let mut combination: Vec<&'static FuncGadget> = Vec::new();
     let func_gagdets = get_func_gadgets();
     while combination.len() < len {
-        let idx: usize = rand::random::<usize>() % func_gagdets.len();
+        let idx: usize = get_global_rng().gen::<usize>() % func_gagdets.len();
         let gadget = &func_gagdets[idx];
         if combination
             .iter()
@@ -1,27 +1,468 @@
 use crate::{
+    analysis::calls::extract_api_calls,
     config::{self, get_config, get_handler_type, get_library_name, HandlerType},
     deopt::Deopt,
     execution::{
-        logger::{init_gtl, ProgramLogger},
-        Executor,
+        logger::{init_gtl, ProgramError, ProgramLogger},
+        max_cpu_count, Executor, Slots,
     },
     feedback::{
+        api_ngrams::{
+            extract_ngrams, ApiNgram, ApiNgramLog, ApiNgramSet, NgramSet, MAX_NGRAM_LEN,
+        },
         observer::Observer,
+        sampling::SamplingController,
         schedule::{rand_choose_combination, Schedule},
     },
     minimize::minimize,
     program::{libfuzzer::LibFuzzer, rand::rand_comb_len, serde::Deserializer, Program},
-    request::{self, prompt::Prompt},
+    request::{
+        self,
+        cache::{get_cache_mode, is_replay_miss, CacheMode},
+        prompt::Prompt,
+    },
     cntg_program::seed_metas::SeedMetas,
 };
-use tree_sitter::{Parser, TreeCursor};
 
 use eyre::Result;
-use std::collections::HashSet;
-use std::io::Write;
+use std::sync::atomic::{AtomicBool, AtomicUsize, Ordering};
+use std::sync::mpsc::{sync_channel, Receiver, SyncSender};
+use std::sync::{Arc, Mutex, RwLock};
+use std::collections::VecDeque;
+use std::thread::{JoinHandle, ScopedJoinHandle};
 use std::time::{Duration, Instant};
 use std::option::Option;
 
+/// The number of batches in the FuzzDriver pipeline: one being sanitized while the next is being generated.
+const PIPELINE_DEPTH: usize = 2;
+
+type SanitizeSender = SyncSender<Vec<Program>>;
+type SanitizeReceiver = Receiver<(Vec<Program>, Result<Vec<Option<ProgramError>>>)>;
+
+/// A seed sent from the generation lanes to the saver of ApiCombination mode.
+enum SaveTask {
+    Succ(Program, Vec<String>, Vec<ApiNgram>, Instant),
+    Err(Program, ProgramError),
+}
+
+/// Save the seeds of all lanes in one thread, so that the seed files, the n-gram log and the
+/// seed metas are written in a serialized order.
+fn save_api_seeds(
+    deopt: &mut Deopt,
+    tasks: Receiver<SaveTask>,
+    start: Instant,
+) -> Result<SeedMetas> {
+    let mut seed_metas = SeedMetas::new(&start);
+    let mut ngram_log = ApiNgramLog::create(&deopt.get_library_succ_seed_dir()?.join("pairs"))?;
+    for task in tasks {
+        match task {
+            SaveTask::Succ(program, calls, ngrams, generation_time) => {
+                let seed_path = deopt.save_succ_program(&program)?;
+                seed_metas.add(&seed_path, generation_time, None, &calls)?;
+                ngram_log.append(program.id, &ngrams)?;
+            }
+            SaveTask::Err(program, err) => {
+                deopt.save_err_program(&program, &err)?;
+            }
+        }
+    }
+    ngram_log.flush()?;
+    Ok(seed_metas)
+}
+
+/// The states shared by the concurrent generation lanes of ApiCombination mode. Each lane keeps its
+/// own prompt and round logger, draws combinations from the shared schedule, and sends seeds to the saver.
+struct ApiLanes<'a> {
+    handler: &'a dyn request::Handler,
+    executor: &'a Executor,
+    /// A snapshot of deopt used to locate the work files, the seeds are saved by the saver.
+    deopt: Deopt,
+    schedule: RwLock<Schedule>,
+    sampling: Mutex<SamplingController>,
+    discovered_api_ngrams: Arc<ApiNgramSet>,
+    seed_id: AtomicUsize,
+    quiet_round: AtomicUsize,
+    loop_cnt: AtomicUsize,
+    stop: AtomicBool,
+    /// Bounds the validations of all lanes together to the CPUs.
+    validation_slots: Slots,
+    timeout: Option<Duration>,
+    start: Instant,
+}
+
+impl<'a> ApiLanes<'a> {
+    fn should_stop(&self) -> bool {
+        if self.stop.load(Ordering::SeqCst) {
+            return true;
+        }
+        if self.quiet_round.load(Ordering::SeqCst) >= get_config().fuzz_converge_round {
+            return true;
+        }
+        if self.timeout.is_some() && self.start.elapsed() > self.timeout.unwrap() {
+            log::info!("Time out is reached. Stopping seed generation.");
+            return true;
+        }
+        false
+    }
+
+    fn run_lane(&self, lane_id: usize, prompt: Prompt, saver: SyncSender<SaveTask>) -> Result<()> {
+        let res = self.lane_loop(lane_id, prompt, &saver);
+        // a lane exits once it converges or fails, either of which stops the other lanes.
+        self.stop.store(true, Ordering::SeqCst);
+        match res {
+            Err(err) if is_replay_miss(&err) => {
+                log::warn!("The replay has diverged from the recording, stop it. {err}");
+                Ok(())
+            }
+            res => res,
+        }
+    }
+
+    fn lane_loop(
+        &self,
+        lane_id: usize,
+        mut prompt: Prompt,
+        saver: &SyncSender<SaveTask>,
+    ) -> Result<()> {
+        let mut logger = ProgramLogger::default();
+        loop {
+            if self.should_stop() {
+                break;
+            }
+            let mut first_prompt = String::from("Hello");
+            if get_config().enable_cot {
+                log::info!("Current prompt is in CoT mode.");
+                // 生成执行计划
+                prompt.set_cot_plan_task();
+                match self.handler.generate_single(&prompt) {
+                    Ok(plan_program) => {
+                        first_prompt = plan_program.statements.clone();
+                        log::info!("Execution plan generated successfully");
+                        log::debug!("Plan:\n{}", first_prompt);
+                    }
+                    Err(e) => {
+                        log::error!("CoT Phase 1 error: {}, falling back", e);
+                    }
+                }
+            }
+
+            Prompt::set_generate_task(&mut prompt);
+            if get_config().enable_cot {
+                prompt.set_cot_code_task(first_prompt);
+                log::info!("Current prompt is in CoT code generation mode.");
+            }
+
+            if get_config().adaptive_sampling {
+                let default_temperature = self.handler.get_default_temperature();
+                let sampling = self.sampling.lock().unwrap();
+                sampling.configure(&mut prompt, default_temperature);
+            }
+            let (rc_succ, rc_total) = (logger.get_rc_succ(), logger.get_rc_total());
+            let programs = self.generate_and_validate_api_sequences(&prompt, &mut logger, saver)?;
+            let round_succ = logger.get_rc_succ() - rc_succ;
+            let round_total = logger.get_rc_total() - rc_total;
+            let loop_count = {
+                let mut schedule = self.schedule.write().unwrap();
+                schedule.increment_loop();
+                schedule.loop_count
+            };
+            log::debug!("lane: {lane_id}, schedule loop count: {loop_count}");
+            if programs.is_empty() {
+                log::debug!("No programs generated successfully, continue to next round.");
+                self.sampling
+                    .lock()
+                    .unwrap()
+                    .update(&prompt.gadgets, round_total, round_succ, 0);
+                self.schedule
+                    .read()
+                    .unwrap()
+                    .update_prompt_for_api_mode(&mut prompt)?;
+                self.loop_cnt.fetch_add(1, Ordering::SeqCst);
+                continue;
+            }
+            let program_len = programs.len();
+            log::debug!(
+                "LLM generated {} successful programs. Sanitize those programs!",
+                program_len
+            );
+            let mut round_newly_discovered_pairs = NgramSet::default();
+            let ngram_len = get_config().api_ngram.clamp(2, MAX_NGRAM_LEN);
+            if let Some(example_program) = programs.last() {
+                log::info!(
+                    "Adding successful program {} as an example for the next prompt.",
+                    example_program.id
+                );
+                prompt.add_successful_example(example_program.statements.clone());
+            }
+            for program in programs {
+                // the calls are extracted once and recorded in the seed metas for minimization.
+                let calls = extract_api_calls(&program.statements);
+                let ngrams = extract_ngrams(&calls, ngram_len);
+                for ngram in &ngrams {
+                    if self.discovered_api_ngrams.insert(*ngram) {
+                        round_newly_discovered_pairs.insert(*ngram);
+                    }
+                }
+                saver
+                    .send(SaveTask::Succ(program, calls, ngrams, Instant::now()))
+                    .map_err(|_| eyre::eyre!("the seed saver exited"))?;
+            }
+            let has_new_in_round = round_newly_discovered_pairs.len() >= get_config().num_new_pairs;
+            let ngrams_per_1k_tokens = {
+                let mut sampling = self.sampling.lock().unwrap();
+                sampling.update(
+                    &prompt.gadgets,
+                    round_total,
+                    round_succ,
+                    round_newly_discovered_pairs.len(),
+                );
+                sampling.get_ngrams_per_1k_tokens().unwrap_or(0.0)
+            };
+
+            if has_new_in_round {
+                self.quiet_round.store(0, Ordering::SeqCst);
+                log::debug!(
+                    "Discovered {} new API pairs in this round.",
+                    round_newly_discovered_pairs.len()
+                );
+                self.schedule
+                    .write()
+                    .unwrap()
+                    .update_energies_from_api_pairs(&round_newly_discovered_pairs);
+            } else {
+                // the rounds without any successful program have continued above.
+                self.quiet_round.fetch_add(1, Ordering::SeqCst);
+            }
+            self.schedule
+                .read()
+                .unwrap()
+                .update_prompt_for_api_mode(&mut prompt)?;
+            let loop_cnt = self.loop_cnt.fetch_add(1, Ordering::SeqCst) + 1;
+            logger.reset_round();
+            let quiet_round = self.quiet_round.load(Ordering::SeqCst);
+            log::info!(
+                "[Mutate Loop]: lane: {lane_id}, loop: {loop_cnt}, quiet_round: {quiet_round}, discovered_api_pairs: {}, new per 1k tokens: {ngrams_per_1k_tokens:.2}",
+                self.discovered_api_ngrams.len()
+            );
+            if quiet_round == get_config().quiet_round && program_len != 0 {
+                break;
+            }
+        }
+        Ok(())
+    }
+
+    fn generate_and_validate_api_sequences(
+        &self,
+        prompt: &Prompt,
+        logger: &mut ProgramLogger,
+        saver: &SyncSender<SaveTask>,
+    ) -> Result<Vec<Program>> {
+        log::trace!(
+            "Generate until {} sucess programs",
+            get_config().fuzz_round_succ
+        );
+        let mut succ_programs = Vec::new();
+
+        while succ_programs.len() < get_config().fuzz_round_succ {
+            let (programs, check_res) = self.stream_and_validate_api_sequences(prompt)?;
+            log::debug!("LLM generated {} programs and sanitized them.", programs.len());
+            let mut failed_programs = Vec::new();
+            for (program, error) in programs.into_iter().zip(check_res) {
+                if let Some(err) = error {
+                    log::warn!(
+                        "Program {} failed validation. Attempting to repair. Error: {}",
+                        program.id,
+                        err
+                    );
+                    failed_programs.push((program, err));
+                } else {
+                    succ_programs.push(program);
+                    logger.log_succ();
+                }
+            }
+
+            // --- 修复逻辑开始 ---
+            // request the repairs of all failed programs at once, then validate the repaired ones together.
+            let mut repaired_programs = Vec::new();
+            let mut repaired_from = Vec::new();
+            let repairs = self.repair_api_sequences(prompt, &failed_programs)?;
+            for (i, repaired_program) in repairs.into_iter().enumerate() {
+                if let Some(mut repaired_program) = repaired_program {
+                    repaired_program.id = failed_programs[i].0.id;
+                    repaired_programs.push(repaired_program);
+                    repaired_from.push(i);
+                }
+            }
+            let repair_res = self.validate_api_sequences(&repaired_programs)?;
+            let mut outcomes: Vec<Option<(Program, Option<ProgramError>)>> =
+                failed_programs.iter().map(|_| None).collect();
+            for ((i, repaired_program), repair_error) in repaired_from
+                .into_iter()
+                .zip(repaired_programs)
+                .zip(repair_res)
+            {
+                outcomes[i] = Some((repaired_program, repair_error));
+            }
+
+            for ((program, err), outcome) in failed_programs.into_iter().zip(outcomes) {
+                match outcome {
+                    Some((repaired_program, None)) => {
+                        log::info!("Successfully repaired program {}!", program.id);
+                        succ_programs.push(repaired_program);
+                        logger.log_succ();
+                    }
+                    Some((_, Some(final_err))) => {
+                        log::error!(
+                            "Repair failed for program {}. Final error: {}",
+                            program.id,
+                            final_err
+                        );
+                        logger.log_err(&final_err);
+                        Self::save_err(saver, program, final_err)?;
+                    }
+                    None => {
+                        log::error!(
+                            "LLM did not return a repaired version for program {}.",
+                            program.id
+                        );
+                        logger.log_err(&err);
+                        Self::save_err(saver, program, err)?;
+                    }
+                }
+            }
+            logger.print_succ_round();
+            if self
+                .schedule
+                .read()
+                .unwrap()
+                .should_shuffle(logger.get_rc_succ(), logger.get_rc_total())
+            {
+                log::info!("Fuzzer stuck in the current prompt, choose a new one.");
+                break;
+            }
+        }
+
+        Ok(succ_programs)
+    }
+
+    /// Validate the programs of a request as their completions arrive, thus the validation of the
+    /// first programs overlaps with the slowest completions. A completion waits for a free
+    /// validation slot shared by all lanes before it is validated.
+    fn stream_and_validate_api_sequences(
+        &self,
+        prompt: &Prompt,
+    ) -> Result<(Vec<Program>, Vec<Option<ProgramError>>)> {
+        let stream = self.handler.generate_stream(prompt)?;
+        std::thread::scope(|s| {
+            let mut handles = VecDeque::new();
+            let mut programs = Vec::new();
+            let mut check_res = Vec::new();
+            let mut join =
+                |handle: ScopedJoinHandle<'_, (Program, Result<Option<ProgramError>>)>| {
+                    let (program, res) = handle
+                        .join()
+                        .map_err(|_| eyre::eyre!("the validation panicked"))?;
+                    programs.push(program);
+                    check_res.push(res?);
+                    Ok::<(), eyre::Report>(())
+                };
+            for program in stream {
+                let mut program = program?;
+                program.id = self.seed_id.fetch_add(1, Ordering::SeqCst);
+                let slot = self.validation_slots.acquire();
+                // join the finished validations in order, to keep few threads around.
+                while handles.front().map_or(false, |handle| handle.is_finished()) {
+                    join(handles.pop_front().unwrap())?;
+                }
+                handles.push_back(s.spawn(move || {
+                    let res = self.executor.validate_api_sequence(&program, &self.deopt);
+                    drop(slot);
+                    (program, res)
+                }));
+            }
+            for handle in handles {
+                join(handle)?;
+            }
+            Ok((programs, check_res))
+        })
+    }
+
+    /// Validate the programs concurrently, each in a validation slot shared by all lanes.
+    fn validate_api_sequences(&self, programs: &[Program]) -> Result<Vec<Option<ProgramError>>> {
+        let check_res: Vec<Result<Option<ProgramError>>> = std::thread::scope(|s| {
+            let handles: Vec<_> = programs
+                .iter()
+                .map(|program| {
+                    let slot = self.validation_slots.acquire();
+                    s.spawn(move || {
+                        let res = self.executor.validate_api_sequence(program, &self.deopt);
+                        drop(slot);
+                        res
+                    })
+                })
+                .collect();
+            handles
+                .into_iter()
+                .map(|handle| {
+                    handle
+                        .join()
+                        .unwrap_or_else(|_| Err(eyre::eyre!("the validation panicked")))
+                })
+                .collect()
+        });
+        check_res.into_iter().collect()
+    }
+
+    /// Request the repairs of failed programs concurrently, one LLM request per program.
+    /// Return the repaired programs in the order of `failed_programs`, or None if the LLM returned nothing.
+    fn repair_api_sequences(
+        &self,
+        prompt: &Prompt,
+        failed_programs: &[(Program, ProgramError)],
+    ) -> Result<Vec<Option<Program>>> {
+        let request_repair = |(program, err): &(Program, ProgramError)| {
+            let mut repair_prompt = prompt.clone();
+            repair_prompt.set_repair_task(program.statements.clone(), err.clone());
+            // only the first repaired program is taken.
+            repair_prompt.n_sample = 1;
+            self.handler.generate(&repair_prompt)
+        };
+        // the recorded requests are repeated in order, as the prompts could draw from the RNG.
+        if get_cache_mode() != CacheMode::Off {
+            let mut repaired_programs = Vec::new();
+            for failed_program in failed_programs {
+                repaired_programs.push(request_repair(failed_program)?.into_iter().next());
+            }
+            return Ok(repaired_programs);
+        }
+        let repairs: Vec<Result<Vec<Program>>> = std::thread::scope(|s| {
+            let handles: Vec<_> = failed_programs
+                .iter()
+                .map(|failed_program| s.spawn(move || request_repair(failed_program)))
+                .collect();
+            handles
+                .into_iter()
+                .map(|handle| {
+                    handle
+                        .join()
+                        .unwrap_or_else(|_| Err(eyre::eyre!("the repair request panicked")))
+                })
+                .collect()
+        });
+        let mut repaired_programs = Vec::new();
+        for repair in repairs {
+            repaired_programs.push(repair?.into_iter().next());
+        }
+        Ok(repaired_programs)
+    }
+
+    fn save_err(saver: &SyncSender<SaveTask>, program: Program, err: ProgramError) -> Result<()> {
+        saver
+            .send(SaveTask::Err(program, err))
+            .map_err(|_| eyre::eyre!("the seed saver exited"))
+    }
+}
+
 pub struct Fuzzer {
     pub deopt: Deopt,
     pub executor: Executor,
@@ -126,184 +567,139 @@ impl Fuzzer {
         Ok(())
     }
 
-    pub fn generate_until_n_success(
-        &mut self,
-        prompt: &mut Prompt,
-        logger: &mut ProgramLogger,
-    ) -> Result<Vec<Program>> {
-        log::trace!(
-            "Generate until {} sucess programs",
-            get_config().fuzz_round_succ
-        );
-        let mut succ_programs = Vec::new();
-
-        while succ_programs.len() < get_config().fuzz_round_succ {
-            let mut programs = self.handler.generate(prompt)?;
-            for program in &mut programs {
-                program.id = self.deopt.inc_seed_id();
-            }
-
-            log::debug!(
-                "LLM generated {} programs. Sanitize those programs!",
-                programs.len()
-            );
-            let check_res = self
-                .executor
-                .check_programs_are_correct(&programs, &self.deopt)?;
-            // Check each generated programs, and save thems according where they contains errors.
-            for (i, program) in programs.iter().enumerate() {
-                let has_err = check_res
-                    .get(i)
-                    .unwrap_or_else(|| panic!("cannot obtain check_res at `{i}`"));
-                // save as error programs
-                if let Some(err_msg) = has_err {
-                    self.deopt.save_err_program(program, err_msg)?;
-                    logger.log_err(err_msg);
-                } else {
-                    succ_programs.push(program.clone());
-                    logger.log_succ();
+    /// Spawn the sanitization stage of the FuzzDriver pipeline. It receives the generated batches in order,
+    /// and sends back each batch with its check results, so that the next LLM request can be issued
+    /// while the current batch is being sanitized.
+    fn spawn_sanitize_stage(&self) -> Result<(SanitizeSender, SanitizeReceiver, JoinHandle<()>)> {
+        let (batch_sender, batch_receiver) = sync_channel::<Vec<Program>>(1);
+        let (res_sender, res_receiver) = sync_channel(1);
+        let executor = self.executor.clone();
+        let deopt = self.deopt.clone();
+        let handle = std::thread::Builder::new()
+            .name("sanitize-stage".to_string())
+            .spawn(move || {
+                for programs in batch_receiver {
+                    let check_res = executor.check_programs_are_correct(&programs, &deopt);
+                    if res_sender.send((programs, check_res)).is_err() {
+                        break;
+                    }
                 }
-            }
-            logger.print_succ_round();
-            // if the combiantion continusely failed in a long time, shuffle the prompt to escape the bad combination;
-            if self
-                .schedule
-                .should_shuffle(logger.get_rc_succ(), logger.get_rc_total())
-            {
-                log::info!("Fuzzer stuck in the current prompt, choose a new one.");
-                break;
-            }
-        }
-
-        Ok(succ_programs)
+            })?;
+        Ok((batch_sender, res_receiver, handle))
     }
-    pub fn generate_and_validate_api_sequences(
+
+    /// Save the sanitized programs of a batch, and update the seed queue and the global branches with
+    /// the coverage of the correct ones. Return the number of correct programs and whether they have new branches.
+    fn feedback_sanitized_batch(
         &mut self,
-        prompt: &mut Prompt,
+        programs: Vec<Program>,
+        check_res: Vec<Option<ProgramError>>,
         logger: &mut ProgramLogger,
-    ) -> Result<Vec<Program>> {
-        log::trace!(
-            "Generate until {} sucess programs",
-            get_config().fuzz_round_succ
-        );
+    ) -> Result<(usize, bool)> {
         let mut succ_programs = Vec::new();
-
-        while succ_programs.len() < get_config().fuzz_round_succ {
-            let mut programs = self.handler.generate(prompt)?;
-            for program in &mut programs {
-                program.id = self.deopt.inc_seed_id();
-            }
-            log::debug!(
-                "LLM generated {} programs. Sanitize those programs!",
-                programs.len()
-            );
-            for program in programs {
-                let error = self.executor.validate_api_sequence(&program, &self.deopt)?;
-
-                if let Some(err) = error {
-                    // --- 修复逻辑开始 ---
-                    log::warn!(
-                        "Program {} failed validation. Attempting to repair. Error: {}",
-                        program.id,
-                        err
-                    );
-
-                    prompt.set_repair_task(program.statements.clone(), err.clone());
-                    let mut repaired_programs = self.handler.generate(prompt)?;
-                    if let Some(repaired_program) = repaired_programs.get_mut(0) {
-                        repaired_program.id = program.id;
-
-                        let repair_error = self
-                            .executor
-                            .validate_api_sequence(repaired_program, &self.deopt)?;
-                        if let Some(final_err) = repair_error {
-                            log::error!(
-                                "Repair failed for program {}. Final error: {}",
-                                program.id,
-                                final_err
-                            );
-                            self.deopt.save_err_program(&program, &final_err)?;
-                            logger.log_err(&final_err);
-                        } else {
-                            log::info!("Successfully repaired program {}!", program.id);
-                            succ_programs.push(repaired_program.clone());
-                            logger.log_succ();
-                        }
-                    } else {
-                        log::error!(
-                            "LLM did not return a repaired version for program {}.",
-                            program.id
-                        );
-                        self.deopt.save_err_program(&program, &err)?;
-                        logger.log_err(&err);
-                    }
-                    // 无论修复成功与否，都将任务重置回生成模式
-                    prompt.set_generate_task();
-                } else {
-                    succ_programs.push(program);
-                    logger.log_succ();
-                }
-            }
-            logger.print_succ_round();
-            if self
-                .schedule
-                .should_shuffle(logger.get_rc_succ(), logger.get_rc_total())
-            {
-                log::info!("Fuzzer stuck in the current prompt, choose a new one.");
-                break;
+        // Check each generated programs, and save thems according where they contains errors.
+        for (i, program) in programs.into_iter().enumerate() {
+            let has_err = check_res
+                .get(i)
+                .unwrap_or_else(|| panic!("cannot obtain check_res at `{i}`"));
+            // save as error programs
+            if let Some(err_msg) = has_err {
+                self.deopt.save_err_program(&program, err_msg)?;
+                logger.log_err(err_msg);
+            } else {
+                succ_programs.push(program);
+                logger.log_succ();
             }
         }
-
-        Ok(succ_programs)
+        logger.print_succ_round();
+
+        let succ_num = succ_programs.len();
+        let mut has_new = false;
+        for mut program in succ_programs {
+            self.deopt.save_succ_program(&program)?;
+            let coverage = self.deopt.get_seed_coverage(program.id)?;
+            let unique_branches = self.observer.has_unique_branch(&coverage);
+            let program_has_new = !unique_branches.is_empty();
+            has_new |= program_has_new;
+            program.update_quality(unique_branches, &self.deopt)?;
+            self.deopt
+                .update_seed_queue(program, &coverage, program_has_new)?;
+            self.observer.merge_coverage(&coverage);
+        }
+        Ok((succ_num, has_new))
     }
-    fn extract_calls_recursive(source: &str, cursor: &mut TreeCursor, calls: &mut Vec<String>) {
-        let node = cursor.node();
 
-        if node.kind() == "call_expression" {
-            if let Some(function_node) = node.child_by_field_name("function") {
-                let func_name = function_node
-                    .utf8_text(source.as_bytes())
-                    .unwrap()
-                    .to_string();
-                calls.push(func_name);
-            }
+    /// Run the generation lanes of ApiCombination mode until they converge or time out.
+    fn api_combination_loop(
+        &mut self,
+        prompt: Prompt,
+        timeout: Option<Duration>,
+        start: Instant,
+    ) -> Result<()> {
+        let mut lane_num = get_config().api_lanes.max(1);
+        // the lanes share the schedule and the RNG, thus their interleaving changes the prompts.
+        if get_cache_mode() != CacheMode::Off && lane_num > 1 {
+            log::warn!("Run a single generation lane to record or replay the LLM requests.");
+            lane_num = 1;
         }
-
-        if cursor.goto_first_child() {
-            Self::extract_calls_recursive(source, cursor, calls);
-            while cursor.goto_next_sibling() {
-                Self::extract_calls_recursive(source, cursor, calls);
+        let lanes = ApiLanes {
+            handler: self.handler.as_ref(),
+            executor: &self.executor,
+            deopt: self.deopt.clone(),
+            schedule: RwLock::new(std::mem::take(&mut self.schedule)),
+            sampling: Mutex::new(SamplingController::new()),
+            discovered_api_ngrams: self.observer.discovered_api_ngrams.clone(),
+            seed_id: AtomicUsize::new(self.deopt.seed_id),
+            quiet_round: AtomicUsize::new(self.quiet_round),
+            loop_cnt: AtomicUsize::new(0),
+            stop: AtomicBool::new(false),
+            validation_slots: Slots::new(max_cpu_count()),
+            timeout,
+            start,
+        };
+        let deopt = &mut self.deopt;
+        let res = std::thread::scope(|s| -> Result<SeedMetas> {
+            let (save_sender, save_receiver) = sync_channel(lane_num * 2);
+            let saver = s.spawn(move || save_api_seeds(deopt, save_receiver, Instant::now()));
+            let mut lane_handles = Vec::new();
+            for lane_id in 0..lane_num {
+                // the first lane starts from the initial prompt, the others draw their own combinations.
+                let prompt = if lane_id == 0 {
+                    prompt.clone()
+                } else {
+                    let schedule = lanes.schedule.read().unwrap();
+                    Prompt::from_combination(schedule.assemble_high_energy_combiantion())
+                };
+                let lanes = &lanes;
+                let save_sender = save_sender.clone();
+                lane_handles.push(s.spawn(move || lanes.run_lane(lane_id, prompt, save_sender)));
             }
-            cursor.goto_parent();
+            drop(save_sender);
+            let mut lane_res = Ok(());
+            for handle in lane_handles {
+                let res = handle
+                    .join()
+                    .unwrap_or_else(|_| Err(eyre::eyre!("the generation lane panicked")));
+                lane_res = lane_res.and(res);
+            }
+            // the lanes fail to send once the saver failed, thus report the saver's error first.
+            let seed_metas = saver
+                .join()
+                .unwrap_or_else(|_| Err(eyre::eyre!("the seed saver panicked")))?;
+            lane_res?;
+            Ok(seed_metas)
+        });
+        self.schedule = lanes.schedule.into_inner().unwrap();
+        self.deopt.seed_id = lanes.seed_id.into_inner();
+        self.quiet_round = lanes.quiet_round.into_inner();
+        let seed_metas = res?;
+        let result = seed_metas.write_to(&self.deopt.get_seed_meta_path().unwrap());
+        if result.is_err() {
+            log::error!("Failed to write seed meta data!");
         }
-    }
-    fn extract_function_calls(source: &str) -> Vec<String> {
-        let mut parser = Parser::new();
-        parser
-            .set_language(tree_sitter_cpp::language())
-            .expect("Failed to load C++ grammar");
-
-        let tree = parser.parse(source, None).expect("Failed to parse code");
-        let root_node = tree.root_node();
-
-        let mut calls = Vec::new();
-        let mut cursor = root_node.walk();
-        Self::extract_calls_recursive(source, &mut cursor, &mut calls);
-        calls
+        Ok(())
     }
 
-    fn extract_3gram_triples(calls: &[String]) -> Vec<(String, String, String)> {
-        calls
-            .windows(3)
-            .filter_map(|w| {
-                if let [a, b, c] = w {
-                    Some((a.clone(), b.clone(), c.clone()))
-                } else {
-                    None
-                }
-            })
-            .collect()
-    }
     fn mutate_prompt(&mut self, prompt: &mut Prompt) -> Result<()> {
         let api_coverage = self.observer.compute_library_api_coverage()?;
         self.schedule.update_energies(api_coverage);
@@ -359,22 +755,56 @@ impl Fuzzer {
 
         if get_config().generation_mode == config::GenerationModeP::FuzzDriver {
             log::info!("Using FuzzDriver mode, initial prompt: {prompt:?}");
+            let (batch_sender, res_receiver, sanitize_stage) = self.spawn_sanitize_stage()?;
+            // the number of batches sent to the sanitization stage but not fed back.
+            let mut in_flight = 0;
+            let mut round_succ = 0;
+            let mut round_has_new = false;
             loop {
                 if self.is_converge() {
                     break;
                 }
-                let programs = self.generate_until_n_success(&mut prompt, &mut logger)?;
-                let is_stuck = self.is_stuck(programs.len());
-                let mut has_new = false;
-                for mut program in programs {
-                    self.deopt.save_succ_program(&program)?;
-                    let coverage = self.deopt.get_seed_coverage(program.id)?;
-                    let unique_branches = self.observer.has_unique_branch(&coverage);
-                    has_new = !unique_branches.is_empty();
-                    program.update_quality(unique_branches, &self.deopt)?;
-                    self.deopt.update_seed_queue(program, &coverage, has_new)?;
-                    self.observer.merge_coverage(&coverage);
+                // the prompt of this batch is mutated by the feedback until the batch before the last one,
+                // as the last one is still being sanitized.
+                let mut programs = match self.handler.generate(&prompt) {
+                    Err(err) if is_replay_miss(&err) => {
+                        log::warn!("The replay has diverged from the recording, stop it. {err}");
+                        break;
+                    }
+                    res => res?,
+                };
+                for program in &mut programs {
+                    program.id = self.deopt.inc_seed_id();
                 }
+                log::debug!(
+                    "LLM generated {} programs. Sanitize those programs!",
+                    programs.len()
+                );
+                batch_sender
+                    .send(programs)
+                    .map_err(|_| eyre::eyre!("the sanitization stage exited"))?;
+                in_flight += 1;
+                if in_flight < PIPELINE_DEPTH {
+                    continue;
+                }
+                let (programs, check_res) = res_receiver.recv()?;
+                in_flight -= 1;
+                let (succ_num, has_new) =
+                    self.feedback_sanitized_batch(programs, check_res?, &mut logger)?;
+                round_succ += succ_num;
+                round_has_new |= has_new;
+
+                // if the combiantion continusely failed in a long time, shuffle the prompt to escape the bad combination;
+                let should_shuffle = self
+                    .schedule
+                    .should_shuffle(logger.get_rc_succ(), logger.get_rc_total());
+                if should_shuffle {
+                    log::info!("Fuzzer stuck in the current prompt, choose a new one.");
+                }
+                if round_succ < get_config().fuzz_round_succ && !should_shuffle {
+                    continue;
+                }
+                let is_stuck = self.is_stuck(round_succ);
                 if !get_config().disable_power_schedule {
                     self.mutate_prompt(&mut prompt)?;
                 } else {
@@ -382,13 +812,25 @@ impl Fuzzer {
                     prompt = Prompt::from_combination(new_comb);
                 }
 
-                if has_new {
+                if round_has_new {
                     self.quiet_round = 0;
                 } else if !is_stuck {
                     self.quiet_round += 1;
                 }
+                round_succ = 0;
+                round_has_new = false;
                 // As the corpus is also evolved, we recheck the seeds on the evolved corpus to eliminate the error programs that was not catched before.
                 if self.should_recheck() && !has_checked {
+                    // the recheck rewrites the seeds and the global branches, so the batches still
+                    // being sanitized are fed back first, and count in the next round.
+                    while in_flight > 0 {
+                        let (programs, check_res) = res_receiver.recv()?;
+                        in_flight -= 1;
+                        let (succ_num, has_new) =
+                            self.feedback_sanitized_batch(programs, check_res?, &mut logger)?;
+                        round_succ += succ_num;
+                        round_has_new |= has_new;
+                    }
                     self.executor.recheck_seed(&mut self.deopt)?;
                     self.observer.recompute_global_coverage()?;
                     self.deopt.load_programs_from_seeds()?;
@@ -404,135 +846,18 @@ impl Fuzzer {
                     self.observer.dump_global_states()
                 );
             }
+            // keep the programs that are still in the pipeline.
+            drop(batch_sender);
+            for (programs, check_res) in res_receiver {
+                self.feedback_sanitized_batch(programs, check_res?, &mut logger)?;
+            }
+            if sanitize_stage.join().is_err() {
+                eyre::bail!("the sanitization stage panicked");
+            }
         } else if get_config().generation_mode == config::GenerationModeP::ApiCombination {
-            let mut seed_metas = SeedMetas::new(&Instant::now());
             //    log::info!("Using api combination mode, initial prompt: {prompt:?}");
             self.schedule.initialize_energies_for_api_mode();
-            // let mut file = std::fs::OpenOptions::new()
-            //     .create(true)
-            //     .append(true)
-            //     .open("output111.txt")?;
-            loop {
-                if self.is_converge() {
-                    break;
-                }
-                if timeout.is_some() && start.elapsed() > timeout.unwrap() {
-                    log::info!("Time out is reached. Stopping seed generation.");
-                    break;
-                }
-                let mut first_prompt=String::from("Hello");
-                if get_config().enable_cot{
-                    log::info!("Current prompt is in CoT mode.");
-                    // 生成执行计划
-                    prompt.set_cot_plan_task();
-                    match self.handler.generate_single(&prompt) {
-                        Ok(plan_program) => {
-                            first_prompt = plan_program.statements.clone();
-                            log::info!("Execution plan generated successfully");
-                            log::debug!("Plan:\n{}", first_prompt);
-                        }
-                        Err(e) => {
-                            log::error!("CoT Phase 1 error: {}, falling back", e);
-                        }
-                    }
-                }
-
-                Prompt::set_generate_task(&mut prompt);
-                if get_config().enable_cot{
-                    prompt.set_cot_code_task(first_prompt);
-                    log::info!("Current prompt is in CoT code generation mode.");
-                }
-                
-                let programs =
-                    self.generate_and_validate_api_sequences(&mut prompt, &mut logger)?;
-                self.schedule.increment_loop();
-                println!(
-                    "Current loop count: {}",
-                    self.schedule.loop_count
-                );
-                if programs.is_empty() {
-                    log::debug!("No programs generated successfully, continue to next round.");
-                    self.schedule.update_prompt_for_api_mode(&mut prompt)?;
-                    loop_cnt += 1;
-                    continue;
-                }
-                let program_len = programs.len();
-                log::debug!(
-                    "LLM generated {} successful programs. Sanitize those programs!",
-                    program_len
-                );
-                //  下面都是跑的
-                let is_stuck = self.is_stuck(programs.len());
-                let mut round_newly_discovered_pairs: HashSet<(String, String,String)> = HashSet::new();
-                let mut successful_programs_this_round: Vec<Program> = Vec::new();
-                for program in programs {
-                    let seed_path = self.deopt.save_succ_program(&program)?;
-                    seed_metas.add(&seed_path, Instant::now(), None);
-                    let cpp_code = &program.statements;
-                    let calls = Self::extract_function_calls(cpp_code);
-                    let pairs = Self::extract_3gram_triples(&calls);
-
-                    // 保存API pairs到新文件
-                    let pairs_dir = self.deopt.get_library_succ_seed_dir()?.join("pairs");
-                    if !pairs_dir.exists() {
-                        std::fs::create_dir_all(&pairs_dir)?;
-                    }
-                    let pairs_path = pairs_dir.join(format!("{}.pairs", program.id));
-                    let mut pairs_file = std::fs::File::create(pairs_path)?;
-                    for pair in &pairs {
-                        writeln!(pairs_file, "(\"{}\", \"{}\",\"{}\")", pair.0, pair.1,pair.2)?;
-                    }
-
-                    successful_programs_this_round.push(program.clone());
-                    let mut discovered_pairs_guard =
-                        self.observer.discovered_api_triples.write().unwrap();
-                    for pair in pairs {
-                        // log::debug!("Discovered API pair: {:?}", pair);
-                        if discovered_pairs_guard.insert(pair.clone()) {
-                          //  writeln!(file, "{:?}", pair)?;
-                            round_newly_discovered_pairs.insert(pair);
-                        }
-                    }
-                }
-                if !successful_programs_this_round.is_empty() {
-                    if let Some(example_program) = successful_programs_this_round.last() {
-                        log::info!(
-                            "Adding successful program {} as an example for the next prompt.",
-                            example_program.id
-                        );
-                        prompt.add_successful_example(example_program.statements.clone());
-                    }
-                }
-                let has_new_in_round = round_newly_discovered_pairs.capacity() >= get_config().num_new_pairs;
-
-                if has_new_in_round {
-                    self.quiet_round = 0;
-                    log::debug!(
-                        "Discovered {} new API pairs in this round.",
-                        round_newly_discovered_pairs.len()
-                    );
-                    self.schedule
-                        .update_energies_from_api_pairs(&round_newly_discovered_pairs);
-                } else if !is_stuck {
-                    self.quiet_round += 1;
-                }
-                self.schedule.update_prompt_for_api_mode(&mut prompt)?;
-                loop_cnt += 1;
-                logger.reset_round();
-                log::info!(
-                    "[Mutate Loop]: loop: {loop_cnt}, quiet_round: {}, discovered_api_pairs: {}",
-                    self.quiet_round,
-                    self.observer.discovered_api_triples.read().unwrap().len()
-                );
-                if self.quiet_round == get_config().quiet_round && program_len != 0 {
-                    break;
-                }
-            }
-            let result = seed_metas.write_to(&self.deopt.get_seed_meta_path().unwrap());
-            if result.is_err() {
-                log::error!("Failed to write seed meta data!");
-            }
-
+            self.api_combination_loop(prompt, timeout, start)?;
         }
         log::info!("Fuzzing loop finished. Starting minimization...");
 
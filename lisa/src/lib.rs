@@ -55,6 +55,8 @@ pub enum FuzzerError {
     RetryError(String, u8),
     #[error("Cannot find `input_data.size();`")]
     FuzzerInputError,
+    #[error("The request is not recorded in the replayed cache: `{0}`.")]
+    ReplayMiss(String),
 }
 
 pub enum Critical {
@@ -1,34 +1,31 @@
-use crate::{deopt::Deopt, feedback::observer::Observer, program::Program};
+use crate::{
+    analysis::calls::extract_api_calls,
+    cntg_program::seed_metas::SeedMetas,
+    config::get_config,
+    deopt::Deopt,
+    execution::{max_cpu_count, Executor},
+    feedback::{
+        api_ngrams::{extract_ngrams, NgramSet},
+        branches::BranchState,
+        observer::Observer,
+    },
+    program::Program,
+};
 use eyre::Result;
-use std::collections::HashSet;
-use std::path::PathBuf;
-fn extract_api_pairs_from_program(program: &Program) -> HashSet<(String, String)> {
-    // This logic is borrowed from fuzzer.rs
-    let mut parser = tree_sitter::Parser::new();
-    parser
-        .set_language(tree_sitter_cpp::language())
-        .expect("Failed to load C++ grammar");
-    let tree = parser.parse(&program.statements, None).unwrap();
-    let mut calls = Vec::new();
-    extract_calls_recursive(tree.root_node(), &program.statements, &mut calls);
-    calls
-        .windows(2)
-        .map(|w| (w[0].clone(), w[1].clone()))
-        .collect()
-}
-
-// Helper for the helper
-fn extract_calls_recursive(node: tree_sitter::Node, source: &str, calls: &mut Vec<String>) {
-    if node.kind() == "call_expression" {
-        if let Some(function_node) = node.child_by_field_name("function") {
-            if let Ok(func_name) = function_node.utf8_text(source.as_bytes()) {
-                calls.push(func_name.to_string());
-            }
+use std::collections::HashMap;
+use std::ffi::OsString;
+use std::path::{Path, PathBuf};
+/// The API pairs of a seed, from the call sequence recorded in the seed metas if there is one.
+fn extract_api_pairs(file: &Path, api_calls: &HashMap<OsString, Vec<String>>) -> Result<NgramSet> {
+    let pairs = match file.file_name().and_then(|name| api_calls.get(name)) {
+        Some(calls) => extract_ngrams(calls, 2),
+        None => {
+            // the seeds of previous runs are not recorded in the seed metas of this run.
+            let program = Program::load_from_path(file)?;
+            extract_ngrams(&extract_api_calls(&program.statements), 2)
         }
-    }
-    for child in node.children(&mut node.walk()) {
-        extract_calls_recursive(child, source, calls);
-    }
+    };
+    Ok(pairs.into_iter().collect())
 }
 
 /// Minimize seed programs by unique API pairs
@@ -37,13 +34,18 @@ pub fn minimize_by_api_pairs(deopt: &Deopt) -> Result<()> {
     let final_seeds_dir = deopt.get_library_seed_dir()?;
 
     // 1. Get all successful programs and the API pairs they contain.
-    let mut programs_with_pairs: Vec<(PathBuf, HashSet<(String, String)>)> = Vec::new();
+    let seed_meta_path = deopt.get_seed_meta_path()?;
+    let api_calls = if seed_meta_path.exists() {
+        SeedMetas::try_from(seed_meta_path.as_path())?.get_api_calls()
+    } else {
+        HashMap::new()
+    };
+    let mut programs_with_pairs: Vec<(PathBuf, NgramSet)> = Vec::new();
     for file in crate::deopt::utils::read_sort_dir(&succ_seeds_dir)? {
         if file.is_dir() {
             continue;
         }
-        let program = Program::load_from_path(&file)?;
-        let pairs = extract_api_pairs_from_program(&program);
+        let pairs = extract_api_pairs(&file, &api_calls)?;
         if !pairs.is_empty() {
             programs_with_pairs.push((file, pairs));
         }
@@ -53,7 +55,7 @@ pub fn minimize_by_api_pairs(deopt: &Deopt) -> Result<()> {
     programs_with_pairs.sort_by(|a, b| b.1.len().cmp(&a.1.len()));
 
     // 3. Greedily select programs that cover new API pairs.
-    let mut covered_pairs: HashSet<(String, String)> = HashSet::new();
+    let mut covered_pairs = NgramSet::default();
     let mut final_seeds = Vec::new();
 
     for (program_path, pairs) in programs_with_pairs {
@@ -91,38 +93,63 @@ pub fn minimize_by_api_pairs(deopt: &Deopt) -> Result<()> {
 pub fn minimize(deopt: &Deopt) -> Result<()> {
     let seeds_dir = deopt.get_library_succ_seed_dir()?;
     // first sort seeds by coverge.
-    let mut program_coverage: Vec<(PathBuf, f32)> = Vec::new();
-    for file in crate::deopt::utils::read_sort_dir(&seeds_dir)? {
-        let program = Program::load_from_path(&file)?;
-        let coverage_rate = Observer::compute_coverage_for_program(program.id, deopt)?;
-        program_coverage.push((file, coverage_rate));
-    }
-    program_coverage.sort_by(|a, b| b.1.partial_cmp(&a.1).unwrap());
-
-    // iterate the sorted seeds, only the seeds still triger unique branch(s) are retained.
+    // the coverage is exported concurrently per chunk of seeds. Only the rate and the hit branches
+    // of each seed are kept for the second pass, as the full coverages of a large corpus would
+    // not fit in memory.
+    let executor = Executor::new(deopt)?;
     let mut observer = Observer::new(deopt);
-    for (program_path, _) in program_coverage {
-        let program = Program::load_from_path(&program_path)?;
-        let seed = deopt.get_seed_path_by_id(program.id)?;
-        let coverage = deopt.get_seed_coverage(program.id)?;
-        let unique_branches = observer.has_unique_branch(&coverage);
-        if unique_branches.is_empty() {
-            if seed.exists() {
-                log::info!(
-                    "Program Seed triggers no unique branch and has been removed: {program_path:?}"
-                );
-                std::fs::remove_file(seed)?;
-            }
-            continue;
+    let mut program_coverage: Vec<(PathBuf, usize, f32, SeedHits)> = Vec::new();
+    let files = crate::deopt::utils::read_sort_dir(&seeds_dir)?;
+    for chunk in files.chunks(max_cpu_count()) {
+        let mut seed_ids = Vec::new();
+        for file in chunk {
+            seed_ids.push(Program::load_from_path(file)?.id);
         }
-        log::info!("{program_path:?} is an unique seed");
-        if !seed.exists() {
-            std::fs::copy(program_path, seed)?;
+        let coverages = deopt.get_seeds_coverage(&executor, &seed_ids)?;
+        for ((file, seed_id), coverage) in chunk.iter().zip(seed_ids).zip(coverages) {
+            let coverage_rate = Observer::compute_coverage_rate(&coverage, deopt);
+            let hits = observer.get_hit_branches(&coverage);
+            program_coverage.push((file.clone(), seed_id, coverage_rate, hits));
         }
-        let new_exp_branches = observer.has_new_branch(&coverage);
-        observer.merge_new_branch(&new_exp_branches);
+    }
+    program_coverage.sort_by(|a, b| b.2.partial_cmp(&a.2).unwrap());
+
+    // iterate the sorted seeds, only the seeds still triger unique branch(s) are retained.
+    for (program_path, seed_id, _, hits) in &program_coverage {
+        minimize_seed(deopt, &mut observer, program_path, *seed_id, hits)?;
     }
 
     log::info!("{}", observer.dump_global_states());
     Ok(())
 }
+
+/// The branches hit by a seed, by the functions they are in.
+type SeedHits = HashMap<String, Vec<BranchState>>;
+
+/// Retain the seed if it still triggers unique branch(s), and merge its hit branches.
+fn minimize_seed(
+    deopt: &Deopt,
+    observer: &mut Observer,
+    program_path: &Path,
+    seed_id: usize,
+    hits: &SeedHits,
+) -> Result<()> {
+    let seed = deopt.get_seed_path_by_id(seed_id)?;
+    let unique_branches = observer.has_new_hit(hits, false);
+    if unique_branches.is_empty() {
+        if seed.exists() {
+            log::info!(
+                "Program Seed triggers no unique branch and has been removed: {program_path:?}"
+            );
+            std::fs::remove_file(seed)?;
+        }
+        return Ok(());
+    }
+    log::info!("{program_path:?} is an unique seed");
+    if !seed.exists() {
+        std::fs::copy(program_path, seed)?;
+    }
+    let new_exp_branches = observer.has_new_hit(hits, get_config().exponent_branch);
+    observer.merge_new_branch(&new_exp_branches);
+    Ok(())
+}
@@ -32,19 +32,15 @@ pub fn prompt_shuffle(prompt: &mut Prompt) {
 /// Insert an high energy API into combination
 fn prompt_insertion(prompt: Vec<String>, schedule: &Schedule) -> Vec<String> {
     let mut combination = prompt;
-    let mut insert_num = 0;
-    loop {
-        let choose_api = schedule.choose_api_by_energy().to_string();
-        if combination.contains(&choose_api) {
-            continue;
-        }
+    let choose_apis: Vec<String> = schedule
+        .choose_apis_by_energy(3, &combination)
+        .into_iter()
+        .map(|x| x.to_string())
+        .collect();
+    for choose_api in choose_apis {
         let ins_idx: usize = get_global_rng().gen::<usize>() % combination.len();
         log::info!("Insert {choose_api} into prompt.");
         combination.insert(ins_idx, choose_api);
-        insert_num += 1;
-        if insert_num >= 3 {
-            break;
-        }
     }
     combination
 }
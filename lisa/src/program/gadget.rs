@@ -10,9 +10,9 @@ use ctype::*;
 use eyre::{Context, Result};
 use once_cell::sync::OnceCell;
 use regex::Regex;
-use std::collections::HashMap;
+use std::collections::{HashMap, HashSet};
 
-use super::{rand::random_sample, Deserialize, Deserializer};
+use super::{Deserialize, Deserializer};
 
 #[derive(Debug, Clone, serde::Serialize, serde::Deserialize)]
 pub struct FuncGadget {
@@ -994,11 +994,66 @@ pub fn get_func_gadget(func: &str) -> Option<&'static FuncGadget> {
     get_func_gadgets().iter().find(|x| x.name == func)
 }
 
+/// The library types in the signature of an API, with the typedefs and qualifiers stripped.
+fn get_custom_types(gadget: &FuncGadget) -> HashSet<String> {
+    std::iter::once(gadget.get_alias_ret_type())
+        .chain(gadget.get_alias_arg_types().iter().map(String::as_str))
+        .map(|ty| get_unsugared_unqualified_type(&retrieve_canonical_type(ty)))
+        .filter(|ty| !ty.is_empty() && !is_primitive_type(ty))
+        .collect()
+}
+
+/// Get the APIs listed in the context of prompts, sorted by name and fixed for the whole run to
+/// keep the prompt prefix cacheable. All APIs are listed if their signatures fit in
+/// `MAX_CONTEXT_API_BYTES`. Otherwise the APIs are picked by their type fan-in, i.e., the number
+/// of APIs sharing the library types in their signatures, which favors the constructors,
+/// destructors and accessors of the central objects over the APIs of peripheral types.
+pub fn get_context_func_gadgets() -> &'static Vec<&'static FuncGadget> {
+    static GADGETS: OnceCell<Vec<&'static FuncGadget>> = OnceCell::new();
+    GADGETS.get_or_init(|| {
+        let mut gadgets: Vec<&FuncGadget> = get_func_gadgets().iter().collect();
+        gadgets.sort_by(|a, b| a.get_func_name().cmp(b.get_func_name()));
+        let total: usize = gadgets.iter().map(|x| x.gen_signature().len() + 1).sum();
+        if total <= config::MAX_CONTEXT_API_BYTES {
+            return gadgets;
+        }
+        let types: Vec<HashSet<String>> = gadgets.iter().map(|x| get_custom_types(x)).collect();
+        let mut users: HashMap<&str, usize> = HashMap::new();
+        for ty in types.iter().flatten() {
+            *users.entry(ty).or_default() += 1;
+        }
+        let fan_in: Vec<usize> = types
+            .iter()
+            .map(|tys| tys.iter().map(|ty| users[ty.as_str()]).sum())
+            .collect();
+        let mut order: Vec<usize> = (0..gadgets.len()).collect();
+        // the sort is stable, so the ties are kept in the order of names.
+        order.sort_by(|a, b| fan_in[*b].cmp(&fan_in[*a]));
+        let mut picked = vec![false; gadgets.len()];
+        let mut budget = config::MAX_CONTEXT_API_BYTES;
+        for idx in order {
+            let len = gadgets[idx].gen_signature().len() + 1;
+            if len <= budget {
+                budget -= len;
+                picked[idx] = true;
+            }
+        }
+        log::debug!(
+            "list {} of {} APIs in the context by their type fan-in",
+            picked.iter().filter(|x| **x).count(),
+            gadgets.len()
+        );
+        gadgets
+            .into_iter()
+            .zip(picked)
+            .filter_map(|(gadget, picked)| picked.then_some(gadget))
+            .collect()
+    })
+}
+
 pub fn dump_func_gadgets_tostr() -> String {
-    let gadgets = get_func_gadgets();
-    let gadgets = random_sample(gadgets, crate::config::MAX_CONTEXT_APIS);
     let mut dump_str = vec![];
-    for gadget in gadgets {
+    for gadget in get_context_func_gadgets() {
         dump_str.push(gadget.gen_signature());
     }
     dump_str.join("\n")
@@ -1031,6 +1086,17 @@ mod tests {
         println!("{funcs:?}");
     }
 
+    #[test]
+    fn test_context_func_gadgets() {
+        Config::init_test("cJSON");
+        let gadgets = get_context_func_gadgets();
+        assert!(gadgets
+            .windows(2)
+            .all(|x| x[0].get_func_name() < x[1].get_func_name()));
+        let total: usize = gadgets.iter().map(|x| x.gen_signature().len() + 1).sum();
+        assert!(total <= config::MAX_CONTEXT_API_BYTES);
+    }
+
     #[test]
     fn test_parse_func_gadgets() -> Result<()> {
         crate::config::Config::init_test("cre2");
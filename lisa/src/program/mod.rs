@@ -117,6 +117,8 @@ pub struct Program {
     pub combination: Vec<&'static FuncGadget>,
     pub statements: String,
     quality: Quality,
+    /// The error of a completion rejected while it was streamed, which fails the sanitization.
+    pub rejected: Option<crate::execution::logger::ProgramError>,
 }
 
 impl Program {
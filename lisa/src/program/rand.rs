@@ -8,7 +8,9 @@ use std::sync::Mutex;
 
 // Initialize the global random number generator (RNG)
 pub static GLOBAL_RNG: Lazy<Mutex<StdRng>> = Lazy::new(|| {
-    let seed = rand::random();
+    let seed = crate::request::cache::get_rng_seed()
+        .unwrap_or_else(|err| panic!("Unable to seed the global RNG: {err}"));
+    log::info!("Seed the global RNG with {seed}");
     Mutex::new(StdRng::seed_from_u64(seed))
 });
 
@@ -59,3 +61,134 @@ pub fn rand_comb_len() -> usize {
     let select_len = random_select(&lens);
     *select_len
 }
+
+/// A Fenwick tree over the sampling weights, which draws an index in O(log n).
+/// The indices drawn in a combination are excluded by subtracting their weights on the fly,
+/// thus sampling k distinct indices takes O(k^2 log n) without mutating the tree.
+#[derive(Debug, Default, Clone)]
+pub struct WeightedSampler {
+    /// 1-based, the node i sums the weights in (i - lowbit(i), i].
+    tree: Vec<f64>,
+    weights: Vec<f64>,
+    total: f64,
+}
+
+impl WeightedSampler {
+    pub fn new(weights: &[f32]) -> Self {
+        let weights: Vec<f64> = weights.iter().map(|x| x.max(0.0) as f64).collect();
+        let mut tree = vec![0.0; weights.len() + 1];
+        // build in O(n) by pushing each node to its parent.
+        for i in 1..tree.len() {
+            tree[i] += weights[i - 1];
+            let parent = i + (i & i.wrapping_neg());
+            if parent < tree.len() {
+                tree[parent] += tree[i];
+            }
+        }
+        let total = weights.iter().sum();
+        Self {
+            tree,
+            weights,
+            total,
+        }
+    }
+
+    pub fn len(&self) -> usize {
+        self.weights.len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.weights.is_empty()
+    }
+
+    /// Find the index whose prefix range contains `target`, with the weights of `excluded` removed.
+    fn find(&self, target: f64, excluded: &[usize]) -> usize {
+        let len = self.len();
+        let mut pos = 0;
+        let mut rest = target;
+        let mut step = if len == 0 { 0 } else { 1 << len.ilog2() };
+        while step > 0 {
+            let next = pos + step;
+            if next <= len {
+                let mut weight = self.tree[next];
+                for idx in excluded {
+                    if *idx >= pos && *idx < next {
+                        weight -= self.weights[*idx];
+                    }
+                }
+                if rest >= weight {
+                    pos = next;
+                    rest -= weight;
+                }
+            }
+            step >>= 1;
+        }
+        pos.min(len - 1)
+    }
+
+    /// Draw `k` distinct indices other than `excluded`. Once the rest weights are all zero,
+    /// the indices are drawn uniformly.
+    pub fn sample_distinct(&self, k: usize, excluded: &[usize]) -> Vec<usize> {
+        let mut chosen: Vec<usize> = excluded
+            .iter()
+            .filter(|x| **x < self.len())
+            .copied()
+            .collect();
+        chosen.sort_unstable();
+        chosen.dedup();
+        let k = k.min(self.len() - chosen.len());
+        let start = chosen.len();
+        let mut rng = get_global_rng();
+        while chosen.len() < start + k {
+            let rest = self.total - chosen.iter().map(|x| self.weights[*x]).sum::<f64>();
+            let mut idx = self.len();
+            if rest > self.total * 1e-9 {
+                idx = self.find(rng.gen_range(0.0..rest), &chosen);
+            }
+            // the float error could land on a drawn or a zero weight index, draw uniformly instead.
+            if idx >= self.len() || self.weights[idx] <= 0.0 || chosen.contains(&idx) {
+                idx = loop {
+                    let idx = rng.gen_range(0..self.len());
+                    if !chosen.contains(&idx) {
+                        break idx;
+                    }
+                };
+            }
+            chosen.push(idx);
+        }
+        chosen.split_off(start)
+    }
+
+    pub fn sample(&self) -> usize {
+        *self
+            .sample_distinct(1, &[])
+            .first()
+            .expect("sample from empty weights")
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_weighted_sampler() {
+        let sampler = WeightedSampler::new(&[0.0, 1.0, 0.0, 3.0, 1.0, 0.0, 2.0]);
+        let mut counts = [0; 7];
+        for _ in 0..1000 {
+            let chosen = sampler.sample_distinct(3, &[6]);
+            assert_eq!(chosen.len(), 3);
+            for idx in &chosen {
+                assert!(*idx != 6 && chosen.iter().filter(|x| *x == idx).count() == 1);
+            }
+            // the positive weights except the excluded are drawn first.
+            assert!(chosen.iter().all(|x| [1, 3, 4].contains(x)));
+            counts[sampler.sample()] += 1;
+        }
+        assert!(counts[3] > counts[1] && counts[0] == 0);
+        // all indices are drawn once the weights run out.
+        let mut all = sampler.sample_distinct(10, &[]);
+        all.sort();
+        assert_eq!(all, (0..7).collect::<Vec<usize>>());
+    }
+}
@@ -0,0 +1,346 @@
+//! A content-addressed store of LLM completions, keyed by the model, the temperature, the number
+//! of samples and the messages of a request. With `--record` every completion is saved into it,
+//! and with `--replay` the requests are served from it without any network access, so that the
+//! rest of the pipeline can be benchmarked and profiled offline and reproducibly.
+//! A recording keeps the seed of its random choices in the cache, which a replay reuses, so the
+//! replay builds the same prompts. A replay stops at the first request that was not recorded,
+//! since the run has diverged from the recording there.
+use super::http::{OpenAIMessage, TokenUsage};
+use crate::{
+    config::{get_config, get_library_name},
+    deopt::utils::StableHasher,
+    execution::logger::ProgramError,
+    program::Program,
+    Deopt, FuzzerError,
+};
+use eyre::Result;
+use once_cell::sync::OnceCell;
+use serde::{Deserialize, Serialize};
+use std::{
+    collections::HashMap,
+    future::Future,
+    io::Write,
+    path::{Path, PathBuf},
+    sync::Mutex,
+};
+
+/// How the completions of LLM requests go through the cache.
+#[derive(Debug, Clone, Copy, PartialEq)]
+pub enum CacheMode {
+    /// Always request the LLM.
+    Off,
+    /// Request the LLM and save the completions.
+    Record,
+    /// Serve the requests from the saved completions only.
+    Replay,
+}
+
+pub fn get_cache_mode() -> CacheMode {
+    let config = get_config();
+    if config.replay {
+        CacheMode::Replay
+    } else if config.record {
+        CacheMode::Record
+    } else {
+        CacheMode::Off
+    }
+}
+
+#[derive(Debug, Clone, Serialize, Deserialize)]
+struct CachedCompletion {
+    content: String,
+    usage: TokenUsage,
+    /// The error of a completion rejected while it was streamed.
+    #[serde(default)]
+    rejected: Option<ProgramError>,
+}
+
+#[derive(Debug, Clone, PartialEq, Eq, Hash)]
+pub struct CacheKey(String);
+
+impl CacheKey {
+    /// The key is a stable digest, so the entries recorded by one build are replayed by another.
+    pub fn new(model: &str, temperature: Option<f32>, n: u8, messages: &[OpenAIMessage]) -> Self {
+        let mut hasher = StableHasher::new();
+        hasher.write(model.as_bytes());
+        match temperature {
+            Some(temperature) => hasher.write(&temperature.to_bits().to_le_bytes()),
+            None => hasher.write(&[]),
+        }
+        hasher.write(&[n]);
+        for message in messages {
+            hasher.write(message.role.as_bytes());
+            hasher.write(message.content.as_bytes());
+        }
+        Self(hasher.finish_hex())
+    }
+}
+
+fn get_cache_dir() -> Result<PathBuf> {
+    static CACHE_DIR: OnceCell<PathBuf> = OnceCell::new();
+    let cache_dir = CACHE_DIR.get_or_try_init(|| -> Result<PathBuf> {
+        let cache_dir = match &get_config().llm_cache_dir {
+            Some(dir) => dir.clone(),
+            None => {
+                let deopt = Deopt::new(get_library_name())?;
+                [deopt.get_library_output_dir()?, "llm_cache".into()]
+                    .iter()
+                    .collect()
+            }
+        };
+        crate::deopt::utils::create_dir_if_nonexist(&cache_dir)?;
+        Ok(cache_dir)
+    })?;
+    Ok(cache_dir.clone())
+}
+
+/// The seed of the global RNG, which is `--seed` or a random one. Under `--record` and `--replay`
+/// the seed stored in the cache is reused, and a recording into a new cache stores its own.
+pub fn get_rng_seed() -> Result<u64> {
+    // the tests draw without any config.
+    if crate::config::CONFIG_INSTANCE.get().is_none() {
+        return Ok(rand::random());
+    }
+    let seed = get_config().seed;
+    match get_cache_mode() {
+        CacheMode::Off => Ok(seed.unwrap_or_else(rand::random)),
+        mode => {
+            let path = get_cache_dir()?.join("seed");
+            load_or_store_seed(&path, seed, mode == CacheMode::Replay)
+        }
+    }
+}
+
+fn load_or_store_seed(path: &Path, seed: Option<u64>, replay: bool) -> Result<u64> {
+    if let Ok(content) = std::fs::read_to_string(path) {
+        let stored: u64 = content.trim().parse()?;
+        if let Some(seed) = seed.filter(|seed| *seed != stored) {
+            eyre::bail!("The cache is recorded with seed {stored} rather than {seed}: {path:?}");
+        }
+        return Ok(stored);
+    }
+    if replay {
+        eyre::bail!("No seed is recorded in the cache: {path:?}");
+    }
+    let seed = seed.unwrap_or_else(rand::random);
+    std::fs::write(path, seed.to_string())?;
+    Ok(seed)
+}
+
+/// Whether `err` is a request that the replayed cache did not record.
+pub fn is_replay_miss(err: &eyre::Report) -> bool {
+    matches!(
+        err.downcast_ref::<FuzzerError>(),
+        Some(FuzzerError::ReplayMiss(_))
+    )
+}
+
+fn get_entry_path(cache_dir: &Path, key: &CacheKey) -> PathBuf {
+    cache_dir.join(format!("{}.jsonl", key.0))
+}
+
+/// Append a completion to the entry of `key`, one json line per completion.
+fn record(cache_dir: &Path, key: &CacheKey, completion: &CachedCompletion) -> Result<()> {
+    static WRITE_LOCK: Mutex<()> = Mutex::new(());
+    let mut line = serde_json::to_string(completion)?;
+    line.push('\n');
+    let _guard = WRITE_LOCK.lock().unwrap();
+    let mut file = std::fs::File::options()
+        .create(true)
+        .append(true)
+        .open(get_entry_path(cache_dir, key))?;
+    file.write_all(line.as_bytes())?;
+    Ok(())
+}
+
+/// The loaded entries and the number of completions of each entry served so far.
+type ReplayState = HashMap<CacheKey, (Vec<CachedCompletion>, usize)>;
+
+/// Serve the next completion of `key`. A prompt requested more times than it was recorded
+/// is served from its first completion again.
+fn replay(cache_dir: &Path, key: &CacheKey) -> Result<CachedCompletion> {
+    static STATE: OnceCell<Mutex<ReplayState>> = OnceCell::new();
+    let mut state = STATE
+        .get_or_init(|| Mutex::new(HashMap::new()))
+        .lock()
+        .unwrap();
+    if !state.contains_key(key) {
+        let path = get_entry_path(cache_dir, key);
+        let content = std::fs::read_to_string(&path)
+            .map_err(|_| FuzzerError::ReplayMiss(path.to_string_lossy().to_string()))?;
+        let mut completions = Vec::new();
+        for line in content.lines().filter(|line| !line.is_empty()) {
+            completions.push(serde_json::from_str(line)?);
+        }
+        if completions.is_empty() {
+            eyre::bail!("The recorded entry is empty: {path:?}");
+        }
+        state.insert(key.clone(), (completions, 0));
+    }
+    let (completions, served) = state.get_mut(key).unwrap();
+    let completion = completions[*served % completions.len()].clone();
+    *served += 1;
+    Ok(completion)
+}
+
+/// Complete a request through the cache according to the mode of this run.
+/// The output tokens of the completion are counted whether it is replayed or not.
+pub async fn complete<F>(key: CacheKey, request: F) -> Result<(Program, TokenUsage)>
+where
+    F: Future<Output = Result<(Program, TokenUsage)>>,
+{
+    let (program, usage) = complete_through_cache(key, request).await?;
+    super::record_completion_tokens(usage.completion_tokens);
+    Ok((program, usage))
+}
+
+async fn complete_through_cache<F>(key: CacheKey, request: F) -> Result<(Program, TokenUsage)>
+where
+    F: Future<Output = Result<(Program, TokenUsage)>>,
+{
+    match get_cache_mode() {
+        CacheMode::Off => request.await,
+        CacheMode::Replay => {
+            let completion = replay(&get_cache_dir()?, &key)?;
+            log::trace!("replay the completion of {}", key.0);
+            let mut program = Program::new(&completion.content);
+            program.rejected = completion.rejected;
+            Ok((program, completion.usage))
+        }
+        CacheMode::Record => {
+            let (program, usage) = request.await?;
+            let completion = CachedCompletion {
+                content: program.statements.clone(),
+                usage,
+                rejected: program.rejected.clone(),
+            };
+            record(&get_cache_dir()?, &key, &completion)?;
+            Ok((program, completion.usage))
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_record_and_replay() -> Result<()> {
+        let cache_dir = std::env::temp_dir().join("lisa_llm_cache_test");
+        if cache_dir.exists() {
+            std::fs::remove_dir_all(&cache_dir)?;
+        }
+        std::fs::create_dir_all(&cache_dir)?;
+        let messages = vec![OpenAIMessage {
+            role: "user".to_string(),
+            content: "write a program".to_string(),
+            name: None,
+        }];
+        let key = CacheKey::new("model", Some(0.7), 2, &messages);
+        assert_ne!(key, CacheKey::new("model", Some(0.6), 2, &messages));
+        assert_ne!(key, CacheKey::new("model", None, 2, &messages));
+        assert_eq!(key.0.len(), 32);
+        for content in ["int a;", "int b;"] {
+            let completion = CachedCompletion {
+                content: content.to_string(),
+                usage: TokenUsage::new(10, 2, 12),
+                rejected: None,
+            };
+            record(&cache_dir, &key, &completion)?;
+        }
+        let served: Vec<String> = (0..3)
+            .map(|_| replay(&cache_dir, &key).unwrap().content)
+            .collect();
+        assert_eq!(served, vec!["int a;", "int b;", "int a;"]);
+        let missing = CacheKey::new("model", Some(0.7), 1, &messages);
+        assert!(is_replay_miss(&replay(&cache_dir, &missing).unwrap_err()));
+        std::fs::remove_dir_all(&cache_dir)?;
+        Ok(())
+    }
+
+    /// A run draws its prompts from the seeded RNG and streams the samples of each request.
+    /// The programs of each request are sorted, as a recording saves them as they arrive.
+    fn run_requests(online: bool) -> Result<Vec<String>> {
+        use rand::{rngs::StdRng, Rng, SeedableRng};
+        let mut rng = StdRng::seed_from_u64(get_rng_seed()?);
+        let mut programs = Vec::new();
+        for _ in 0..3 {
+            let prompt = format!("write a program with api {}", rng.gen_range(0..1000));
+            let messages = vec![OpenAIMessage {
+                role: "user".to_string(),
+                content: prompt.clone(),
+                name: None,
+            }];
+            let key = CacheKey::new("model", Some(0.7), 2, &messages);
+            let completions = (0..2)
+                .map(|i| {
+                    let content = format!("// {prompt}: {i}");
+                    let request = async move {
+                        if !online {
+                            eyre::bail!("a replay should not request the LLM");
+                        }
+                        Ok((Program::new(&content), TokenUsage::new(10, 2, 12)))
+                    };
+                    complete(key.clone(), request)
+                })
+                .collect();
+            let mut request_programs = Vec::new();
+            for program in super::super::spawn_program_stream(completions, "Test") {
+                request_programs.push(program?.statements);
+            }
+            request_programs.sort();
+            programs.extend(request_programs);
+        }
+        Ok(programs)
+    }
+
+    #[test]
+    fn test_replay_run() -> Result<()> {
+        crate::config::Config::init_test("cJSON");
+        let cache_dir = std::env::temp_dir().join("lisa_llm_replay_test");
+        if cache_dir.exists() {
+            std::fs::remove_dir_all(&cache_dir)?;
+        }
+        let set_mode = |record: bool, replay: bool, seed: Option<u64>| {
+            let mut config = crate::config::CONFIG_INSTANCE
+                .get()
+                .unwrap()
+                .write()
+                .unwrap();
+            config.record = record;
+            config.replay = replay;
+            config.seed = seed;
+            config.llm_cache_dir = Some(cache_dir.clone());
+        };
+
+        set_mode(true, false, Some(7));
+        let recorded = run_requests(true)?;
+        assert_eq!(std::fs::read_to_string(cache_dir.join("seed"))?, "7");
+
+        // the replay reuses the recorded seed, and never requests the LLM.
+        set_mode(false, true, None);
+        assert_eq!(get_rng_seed()?, 7);
+        assert_eq!(run_requests(false)?, recorded);
+        set_mode(false, true, Some(8));
+        assert!(get_rng_seed().is_err());
+
+        // a prompt that was not recorded is a replay miss.
+        let messages = vec![OpenAIMessage {
+            role: "user".to_string(),
+            content: "an unseen prompt".to_string(),
+            name: None,
+        }];
+        let key = CacheKey::new("model", Some(0.7), 2, &messages);
+        let request = async {
+            Err::<(Program, TokenUsage), _>(eyre::eyre!("a replay should not request the LLM"))
+        };
+        let err = super::super::get_runtime()
+            .block_on(complete(key, request))
+            .unwrap_err();
+        assert!(is_replay_miss(&err));
+
+        set_mode(false, false, None);
+        std::fs::remove_dir_all(&cache_dir)?;
+        Ok(())
+    }
+}
@@ -5,17 +5,30 @@ use reqwest::{Client, Error as ReqwestError, Method, Response};
 use serde::{Deserialize, Serialize};
 use serde_json::Value;
 use std::collections::HashMap;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::Arc;
 use std::time::Duration;
+use tokio::sync::SemaphorePermit;
 use tokio::time::timeout;
 
-use crate::program::Program;
+use super::{
+    acquire_request_permit, build_http_client,
+    cache::{self, CacheKey},
+    get_http_client, get_runtime, spawn_program_stream,
+    stream::{CompletionMonitor, StreamVerdict},
+    ProgramStream, DEFAULT_CONNECT_TIMEOUT,
+};
+use crate::{execution::logger::ProgramError, program::Program};
 
 /// Token使用统计结构
-#[derive(Debug, Clone, Default)]
+#[derive(Debug, Clone, Default, Serialize, Deserialize)]
 pub struct TokenUsage {
     pub prompt_tokens: u32,
     pub completion_tokens: u32,
     pub total_tokens: u32,
+    /// The prompt tokens served from the prefix cache of the server.
+    #[serde(default)]
+    pub cached_tokens: u32,
 }
 
 impl TokenUsage {
@@ -24,6 +37,7 @@ impl TokenUsage {
             prompt_tokens,
             completion_tokens,
             total_tokens,
+            cached_tokens: 0,
         }
     }
 
@@ -32,6 +46,7 @@ impl TokenUsage {
             prompt_tokens: usage.prompt_tokens,
             completion_tokens: usage.completion_tokens,
             total_tokens: usage.total_tokens,
+            cached_tokens: usage.get_cached_tokens(),
         }
     }
 
@@ -39,7 +54,29 @@ impl TokenUsage {
         self.prompt_tokens += other.prompt_tokens;
         self.completion_tokens += other.completion_tokens;
         self.total_tokens += other.total_tokens;
+        self.cached_tokens += other.cached_tokens;
+    }
+}
+
+/// The temperature of the requests whose prompt does not set one.
+const DEFAULT_TEMPERATURE: f32 = 0.7;
+
+static PROMPT_TOKENS: AtomicU64 = AtomicU64::new(0);
+static CACHED_PROMPT_TOKENS: AtomicU64 = AtomicU64::new(0);
+
+/// Accumulate the prompt tokens of a completion for the prefix cache hit rate.
+fn record_prompt_cache(usage: &TokenUsage) {
+    PROMPT_TOKENS.fetch_add(usage.prompt_tokens as u64, Ordering::Relaxed);
+    CACHED_PROMPT_TOKENS.fetch_add(usage.cached_tokens as u64, Ordering::Relaxed);
+}
+
+/// The ratio of prompt tokens read from the prefix cache over all requests so far.
+pub fn get_prompt_cache_hit_rate() -> f32 {
+    let prompt = PROMPT_TOKENS.load(Ordering::Relaxed);
+    if prompt == 0 {
+        return 0.0;
     }
+    CACHED_PROMPT_TOKENS.load(Ordering::Relaxed) as f32 / prompt as f32
 }
 
 /// HTTP客户端配置
@@ -65,7 +102,7 @@ impl Default for HttpClientConfig {
         Self {
             base_url: "https://api.openai.com".to_string(),
             timeout: Duration::from_secs(180),
-            connect_timeout: Duration::from_secs(10),
+            connect_timeout: DEFAULT_CONNECT_TIMEOUT,
             default_headers: headers,
             retry_attempts: 3,
             retry_delay: Duration::from_secs(2),
@@ -102,6 +139,14 @@ pub struct OpenAIRequest {
     pub stop: Option<Vec<String>>,
     #[serde(skip_serializing_if = "Option::is_none")]
     pub stream: Option<bool>,
+    #[serde(skip_serializing_if = "Option::is_none")]
+    pub stream_options: Option<OpenAIStreamOptions>,
+}
+
+/// OpenAI流式选项
+#[derive(Debug, Clone, Serialize, Deserialize)]
+pub struct OpenAIStreamOptions {
+    pub include_usage: bool,
 }
 
 /// OpenAI消息结构
@@ -152,6 +197,60 @@ pub struct OpenAIUsage {
     pub cache_creation_input_tokens: u32,
     #[serde(default)]
     pub cache_read_input_tokens: u32,
+    /// Reported by vLLM and OpenAI, while `cache_read_input_tokens` is reported by Anthropic.
+    #[serde(default, skip_serializing_if = "Option::is_none")]
+    pub prompt_tokens_details: Option<OpenAIPromptTokensDetails>,
+}
+
+#[derive(Debug, Clone, Default, Serialize, Deserialize)]
+pub struct OpenAIPromptTokensDetails {
+    #[serde(default)]
+    pub cached_tokens: u32,
+}
+
+impl OpenAIUsage {
+    pub fn get_cached_tokens(&self) -> u32 {
+        let details = self
+            .prompt_tokens_details
+            .as_ref()
+            .map_or(0, |details| details.cached_tokens);
+        self.cache_read_input_tokens.max(details)
+    }
+}
+
+/// OpenAI流式响应块
+#[derive(Debug, Clone, Deserialize)]
+pub struct OpenAIStreamChunk {
+    #[serde(default)]
+    pub choices: Vec<OpenAIStreamChoice>,
+    #[serde(default)]
+    pub usage: Option<OpenAIUsage>,
+    #[serde(default)]
+    pub error: Option<Value>,
+}
+
+/// OpenAI流式选择结构
+#[derive(Debug, Clone, Deserialize)]
+pub struct OpenAIStreamChoice {
+    #[serde(default)]
+    pub delta: OpenAIDelta,
+}
+
+/// OpenAI流式增量结构
+#[derive(Debug, Clone, Default, Deserialize)]
+pub struct OpenAIDelta {
+    #[serde(default)]
+    pub content: Option<String>,
+}
+
+/// The content received by a streamed completion.
+#[derive(Debug, Clone, Default)]
+pub struct StreamedCompletion {
+    pub content: String,
+    pub usage: Option<OpenAIUsage>,
+    /// The number of content deltas, which approximates the completion tokens.
+    pub chunks: usize,
+    pub cancelled: bool,
 }
 
 /// HTTP客户端错误类型
@@ -177,22 +276,19 @@ pub struct HttpClient {
 
 impl HttpClient {
     /// 创建新的HTTP客户端实例
+    /// The connections are pooled by the process-wide client, thus the timeout and the headers
+    /// are set per request. A config with another connect timeout gets a client of its own.
     pub fn new(config: HttpClientConfig) -> Result<Self> {
-        let mut headers = reqwest::header::HeaderMap::new();
-
-        // 添加默认头部
+        // 校验默认头部
         for (key, value) in &config.default_headers {
-            let header_name: reqwest::header::HeaderName = key.parse()?;
-            let header_value: reqwest::header::HeaderValue = value.parse()?;
-            headers.insert(header_name, header_value);
+            let _: reqwest::header::HeaderName = key.parse()?;
+            let _: reqwest::header::HeaderValue = value.parse()?;
         }
-
-        let client = Client::builder()
-            .timeout(config.timeout)
-            .connect_timeout(config.connect_timeout)
-            .default_headers(headers)
-            .build()?;
-
+        let client = if config.connect_timeout == DEFAULT_CONNECT_TIMEOUT {
+            get_http_client().clone()
+        } else {
+            build_http_client(config.connect_timeout)?
+        };
         Ok(Self { client, config })
     }
 
@@ -219,7 +315,7 @@ impl HttpClient {
     pub async fn chat_completion(&self, request: &OpenAIRequest) -> Result<OpenAIResponse> {
         let url = format!("{}/chat/completions", self.config.base_url);
 
-        let response = self
+        let (response, _permit) = self
             .send_request_with_retry(
                 Method::POST,
                 &url,
@@ -231,6 +327,72 @@ impl HttpClient {
         self.parse_openai_response(response).await
     }
 
+    /// 发送流式聊天完成请求
+    /// `on_content` receives the content so far and the number of new deltas,
+    /// and the stream is cancelled once it returns false.
+    pub async fn chat_completion_stream<F>(
+        &self,
+        request: &OpenAIRequest,
+        mut on_content: F,
+    ) -> Result<StreamedCompletion>
+    where
+        F: FnMut(&str, usize) -> bool,
+    {
+        let url = format!("{}/chat/completions", self.config.base_url);
+        let mut request = request.clone();
+        request.stream = Some(true);
+        request.stream_options = Some(OpenAIStreamOptions {
+            include_usage: true,
+        });
+        let (mut response, _permit) = self
+            .send_request_with_retry(Method::POST, &url, Some(&request), None)
+            .await?;
+
+        let mut completion = StreamedCompletion::default();
+        // the events are split by lines, which could be split across chunks.
+        let mut buffer: Vec<u8> = Vec::new();
+        while let Some(chunk) = response.chunk().await? {
+            buffer.extend_from_slice(&chunk);
+            while let Some(pos) = buffer.iter().position(|x| *x == b'\n') {
+                let line: Vec<u8> = buffer.drain(..=pos).collect();
+                let line = String::from_utf8_lossy(&line);
+                let Some(data) = line.trim().strip_prefix("data:") else {
+                    continue;
+                };
+                let data = data.trim();
+                if data == "[DONE]" {
+                    return Ok(completion);
+                }
+                let event: OpenAIStreamChunk = serde_json::from_str(data).map_err(|e| {
+                    HttpClientError::ParseError(format!("Failed to parse event: {} | {}", e, data))
+                })?;
+                if let Some(error) = event.error {
+                    return Err(eyre!("OpenAI API error: {}", error));
+                }
+                if event.usage.is_some() {
+                    completion.usage = event.usage;
+                }
+                let mut new_chunks = 0;
+                for choice in event.choices {
+                    if let Some(content) = choice.delta.content {
+                        completion.content.push_str(&content);
+                        new_chunks += 1;
+                    }
+                }
+                if new_chunks == 0 {
+                    continue;
+                }
+                completion.chunks += new_chunks;
+                if !on_content(&completion.content, new_chunks) {
+                    // dropping the response closes the stream.
+                    completion.cancelled = true;
+                    return Ok(completion);
+                }
+            }
+        }
+        Ok(completion)
+    }
+
     /// 发送通用HTTP请求
     pub async fn send_request<T: Serialize>(
         &self,
@@ -239,7 +401,13 @@ impl HttpClient {
         body: Option<&T>,
         headers: Option<HashMap<String, String>>,
     ) -> Result<Response> {
-        let mut request_builder = self.client.request(method, url);
+        let mut request_builder = self
+            .client
+            .request(method, url)
+            .timeout(self.config.timeout);
+        for (key, value) in &self.config.default_headers {
+            request_builder = request_builder.header(key, value);
+        }
 
         // 添加自定义头部
         if let Some(headers) = headers {
@@ -270,42 +438,41 @@ impl HttpClient {
     }
 
     /// 带重试机制的请求发送
+    /// Each attempt takes a request permit, which is returned with the response, so the body is
+    /// read under it, and released before the backoff sleeps.
     async fn send_request_with_retry<T: Serialize>(
         &self,
         method: Method,
         url: &str,
         body: Option<&T>,
         headers: Option<HashMap<String, String>>,
-    ) -> Result<Response> {
+    ) -> Result<(Response, SemaphorePermit<'static>)> {
         let mut last_error = None;
 
         for attempt in 0..self.config.retry_attempts {
-            match timeout(
+            let permit = acquire_request_permit().await;
+            let res = timeout(
                 self.config.timeout,
                 self.send_request(method.clone(), url, body, headers.clone()),
             )
-            .await
-            {
-                Ok(Ok(response)) => return Ok(response),
+            .await;
+            let error = match res {
+                Ok(Ok(response)) => return Ok((response, permit)),
                 Ok(Err(e)) => {
-                    last_error = Some(e);
-                    log::warn!("Request attempt {} failed: {:?}", attempt + 1, last_error);
-
-                    if attempt < self.config.retry_attempts - 1 {
-                        tokio::time::sleep(self.config.retry_delay).await;
-                    }
-                }
-                Err(_) => {
-                    let timeout_error = HttpClientError::TimeoutError(format!(
-                        "Request to {} timed out after {:?}",
-                        url, self.config.timeout
-                    ));
-                    last_error = Some(timeout_error.into());
-
-                    if attempt < self.config.retry_attempts - 1 {
-                        tokio::time::sleep(self.config.retry_delay).await;
-                    }
+                    log::warn!("Request attempt {} failed: {:?}", attempt + 1, e);
+                    e
                 }
+                Err(_) => HttpClientError::TimeoutError(format!(
+                    "Request to {} timed out after {:?}",
+                    url, self.config.timeout
+                ))
+                .into(),
+            };
+            last_error = Some(error);
+            drop(permit);
+
+            if attempt < self.config.retry_attempts - 1 {
+                tokio::time::sleep(self.config.retry_delay).await;
             }
         }
 
@@ -453,6 +620,7 @@ impl HttpClient {
             presence_penalty: None,
             stop: None,
             stream: Some(false),
+            stream_options: None,
         }
     }
 
@@ -572,18 +740,25 @@ impl OpenAIMessageBuilder {
     }
 }
 
+/// The API key of the requests. A replay never reaches the network, thus runs without one.
+fn get_api_key() -> Result<String> {
+    match std::env::var("OPENAI_API_KEY") {
+        Ok(api_key) => Ok(api_key),
+        Err(_) if cache::get_cache_mode() == cache::CacheMode::Replay => Ok(String::new()),
+        Err(_) => Err(eyre!("OPENAI_API_KEY environment variable not set")),
+    }
+}
+
 /// 基于HTTP客户端的Handler实现
 /// 这个实现展示了如何使用HTTP客户端来处理OpenAI请求
 pub struct HttpHandler {
-    client: HttpClient,
-    rt: tokio::runtime::Runtime,
+    client: Arc<HttpClient>,
 }
 
 impl HttpHandler {
     /// 创建新的HttpHandler实例
     pub fn new() -> Result<Self> {
-        let api_key = std::env::var("OPENAI_API_KEY")
-            .map_err(|_| eyre!("OPENAI_API_KEY environment variable not set"))?;
+        let api_key = get_api_key()?;
         let base_url = crate::config::get_openai_proxy()
             .clone()
             .unwrap_or_else(|| "https://api.openai.com/v1".to_string());
@@ -592,36 +767,47 @@ impl HttpHandler {
             .with_api_key(&api_key)
             .with_base_url(&base_url);
 
-        let rt = tokio::runtime::Builder::new_current_thread()
-            .enable_all()
-            .build()
-            .map_err(|e| eyre!("Failed to create tokio runtime: {}", e))?;
-
-        Ok(Self { client, rt })
+        Ok(Self {
+            client: Arc::new(client),
+        })
     }
 
     /// 使用自定义配置创建HttpHandler
     pub fn with_config(config: HttpClientConfig, api_key: &str) -> Result<Self> {
         let client = HttpClient::new(config)?.with_api_key(api_key);
 
-        let rt = tokio::runtime::Builder::new_current_thread()
-            .enable_all()
-            .build()
-            .map_err(|e| eyre!("Failed to create tokio runtime: {}", e))?;
-
-        Ok(Self { client, rt })
+        Ok(Self {
+            client: Arc::new(client),
+        })
     }
 
-    /// 异步生成单个程序
+    /// 异步生成单个程序, which is one of the `n` samples of the messages.
+    /// The temperature defaults to `DEFAULT_TEMPERATURE` if None.
     async fn generate_single_program(
-        &self,
+        client: Arc<HttpClient>,
         messages: Vec<OpenAIMessage>,
         model: String,
         strip_wrapper: bool,
+        n: u8,
+        temperature: Option<f32>,
     ) -> Result<(Program, TokenUsage)> {
-        let request = HttpClient::build_openai_request(&model, messages, Some(0.7), None);
+        let temperature = temperature.or(Some(DEFAULT_TEMPERATURE));
+        let request = HttpClient::build_openai_request(&model, messages, temperature, None);
+        let key = CacheKey::new(&request.model, request.temperature, n, &request.messages);
+        cache::complete(key, Self::request_program(client, request, strip_wrapper)).await
+    }
 
-        let response = self.client.chat_completion(&request).await?;
+    async fn request_program(
+        client: Arc<HttpClient>,
+        request: OpenAIRequest,
+        strip_wrapper: bool,
+    ) -> Result<(Program, TokenUsage)> {
+        // the plans of CoT are prose, which are not checked while streaming.
+        if strip_wrapper && crate::config::get_config().stream_completions {
+            return Self::generate_streamed_program(client, request).await;
+        }
+
+        let response = client.chat_completion(&request).await?;
 
         if response.choices.is_empty() {
             return Err(eyre!("No choices returned from OpenAI API"));
@@ -631,12 +817,13 @@ impl HttpHandler {
 
         // 根据参数决定是否剥离代码包装器
         let final_content = if strip_wrapper {
-            self.strip_code_wrapper(content)
+            Self::strip_code_wrapper(content)
         } else {
             content.to_string()
         };
         
         let usage = TokenUsage::from_openai_usage(&response.usage);
+        record_prompt_cache(&usage);
 
         Ok((Program::new(&final_content), usage))
     }
@@ -644,21 +831,49 @@ impl HttpHandler {
   
 
 
+    /// Generate a program by streaming, which is cancelled once the monitor rejects it.
+    async fn generate_streamed_program(
+        client: Arc<HttpClient>,
+        request: OpenAIRequest,
+    ) -> Result<(Program, TokenUsage)> {
+        let mut monitor = CompletionMonitor::for_library();
+        let mut verdict = StreamVerdict::Continue;
+        let completion = client
+            .chat_completion_stream(&request, |content, new_chunks| {
+                verdict = monitor.check(content, new_chunks);
+                matches!(verdict, StreamVerdict::Continue)
+            })
+            .await?;
+        let mut program = Program::new(&Self::strip_code_wrapper(&completion.content));
+        if let StreamVerdict::Reject(reason) = verdict {
+            log::debug!("Cancel a streamed completion: {reason}");
+            // the rejected program is kept, thus its failure is still counted in this round.
+            let err = format!("cancelled while streaming: {reason}");
+            program.rejected = Some(ProgramError::Syntax(err));
+        }
+        let usage = match &completion.usage {
+            Some(usage) => TokenUsage::from_openai_usage(usage),
+            None => TokenUsage::new(0, completion.chunks as u32, completion.chunks as u32),
+        };
+        record_prompt_cache(&usage);
+        Ok((program, usage))
+    }
+
     /// 剥离代码包装器（复制自openai.rs）
-    fn strip_code_wrapper(&self, input: &str) -> String {
+    fn strip_code_wrapper(input: &str) -> String {
         let mut input = input.trim();
         let mut event = "";
         if let Some(idx) = input.find("```") {
             event = &input[..idx];
             input = &input[idx..];
         }
-        let input = self.strip_code_prefix(input, "cpp");
-        let input = self.strip_code_prefix(input, "CPP");
-        let input = self.strip_code_prefix(input, "C++");
-        let input = self.strip_code_prefix(input, "c++");
-        let input = self.strip_code_prefix(input, "c");
-        let input = self.strip_code_prefix(input, "C");
-        let input = self.strip_code_prefix(input, "\n");
+        let input = Self::strip_code_prefix(input, "cpp");
+        let input = Self::strip_code_prefix(input, "CPP");
+        let input = Self::strip_code_prefix(input, "C++");
+        let input = Self::strip_code_prefix(input, "c++");
+        let input = Self::strip_code_prefix(input, "c");
+        let input = Self::strip_code_prefix(input, "C");
+        let input = Self::strip_code_prefix(input, "\n");
         if let Some(idx) = input.rfind("```") {
             let input = &input[..idx];
             let input = ["/*", event, "*/\n", input].concat();
@@ -667,7 +882,7 @@ impl HttpHandler {
         ["/*", event, "*/\n", input].concat()
     }
 
-    fn strip_code_prefix<'a>(&self, input: &'a str, pat: &str) -> &'a str {
+    fn strip_code_prefix<'a>(input: &'a str, pat: &str) -> &'a str {
         let pat = String::from_iter(["```", pat]);
         if input.starts_with(&pat) {
             if let Some(p) = input.strip_prefix(&pat) {
@@ -678,23 +893,11 @@ impl HttpHandler {
     }
 }
 
-impl super::Handler for HttpHandler {
-    fn generate(&self, prompt: &super::prompt::Prompt) -> eyre::Result<Vec<Program>> {
-        let start = std::time::Instant::now();
-
-        // 将prompt转换为ChatGPT消息
-        let chat_msgs = prompt.to_chatgpt_message();
-
-        // 转换为我们的消息格式
-        let messages: Vec<OpenAIMessage> = chat_msgs
-            .iter()
-            .map(|msg| HttpClient::convert_chat_message(msg))
-            .collect();
-
-        // 获取配置
+impl HttpHandler {
+    /// The number of programs sampled for a prompt.
+    fn get_sample_num(prompt: &super::prompt::Prompt) -> u8 {
         let config = crate::config::get_config();
-        let model = crate::config::get_openai_model_name().clone();
-        let mut num=config.n_sample;
+        let mut num = prompt.n_sample;
         if config.enable_cot {
             match &prompt.task {
                 crate::request::prompt::ProgramTask::CotPlan => {
@@ -704,7 +907,7 @@ impl super::Handler for HttpHandler {
                 }
                 crate::request::prompt::ProgramTask::CotCode { .. } => {
                     // CoT阶段2: 根据计划生成代码，并行生成多个
-                    num = config.n_sample;
+                    num = prompt.n_sample;
                     log::debug!("CoT Phase 2: Generating {} programs based on plan", num);
                 }
                 _ => {
@@ -712,6 +915,25 @@ impl super::Handler for HttpHandler {
                 }
             }
         }
+        num
+    }
+}
+
+impl super::Handler for HttpHandler {
+    fn generate(&self, prompt: &super::prompt::Prompt) -> eyre::Result<Vec<Program>> {
+        let start = std::time::Instant::now();
+
+        // 将prompt转换为ChatGPT消息
+        let chat_msgs = prompt.to_chatgpt_message();
+
+        // 转换为我们的消息格式
+        let messages: Vec<OpenAIMessage> = chat_msgs
+            .iter()
+            .map(|msg| HttpClient::convert_chat_message(msg))
+            .collect();
+
+        let model = crate::config::get_openai_model_name().clone();
+        let num = Self::get_sample_num(prompt);
         // 创建异步任务，并行执行
         let mut futures = Vec::new();
         
@@ -721,12 +943,19 @@ impl super::Handler for HttpHandler {
         for _ in 0..num {
             let messages_clone = messages.clone();
             let model_clone = model.clone();
-            let future = self.generate_single_program(messages_clone, model_clone, strip_wrapper);
+            let future = Self::generate_single_program(
+                self.client.clone(),
+                messages_clone,
+                model_clone,
+                strip_wrapper,
+                num,
+                prompt.temperature,
+            );
             futures.push(future);
         }
 
         // 并行执行所有任务
-        let results = self.rt.block_on(join_all(futures));
+        let results = get_runtime().block_on(join_all(futures));
 
         let mut programs = Vec::new();
         let mut total_usage = TokenUsage::default();
@@ -740,14 +969,44 @@ impl super::Handler for HttpHandler {
         let elapsed = start.elapsed();
         log::info!("HTTP Client Generate time: {}s", elapsed.as_secs());
         log::info!(
-            "HTTP Client Token Usage - Prompt: {}, Completion: {}, Total: {}",
+            "HTTP Client Token Usage - Prompt: {}, Completion: {}, Total: {}, Cached: {}",
             total_usage.prompt_tokens,
             total_usage.completion_tokens,
-            total_usage.total_tokens
+            total_usage.total_tokens,
+            total_usage.cached_tokens
+        );
+        log::info!(
+            "Prompt cache hit rate: {:.2}%",
+            get_prompt_cache_hit_rate() * 100.0
         );
 
         Ok(programs)
     }
+
+    fn generate_stream(&self, prompt: &super::prompt::Prompt) -> eyre::Result<ProgramStream> {
+        let messages: Vec<OpenAIMessage> = prompt
+            .to_chatgpt_message()
+            .iter()
+            .map(HttpClient::convert_chat_message)
+            .collect();
+        let model = crate::config::get_openai_model_name().clone();
+        let strip_wrapper = !matches!(&prompt.task, crate::request::prompt::ProgramTask::CotPlan);
+        let num = Self::get_sample_num(prompt);
+        let completions = (0..num)
+            .map(|_| {
+                Self::generate_single_program(
+                    self.client.clone(),
+                    messages.clone(),
+                    model.clone(),
+                    strip_wrapper,
+                    num,
+                    prompt.temperature,
+                )
+            })
+            .collect();
+        Ok(spawn_program_stream(completions, "HTTP Client"))
+    }
+
     fn generate_single(&self, prompt: &super::prompt::Prompt) -> eyre::Result<Program> {
         let start = std::time::Instant::now();
 
@@ -767,7 +1026,14 @@ impl super::Handler for HttpHandler {
         let strip_wrapper = !matches!(&prompt.task, crate::request::prompt::ProgramTask::CotPlan);
 
         // 生成单个程序
-        let (program, usage) = self.rt.block_on(self.generate_single_program(messages, model, strip_wrapper))?;
+        let (program, usage) = get_runtime().block_on(Self::generate_single_program(
+            self.client.clone(),
+            messages,
+            model,
+            strip_wrapper,
+            1,
+            prompt.temperature,
+        ))?;
 
         let elapsed = start.elapsed();
         log::info!("HTTP Client Generate Single time: {}s", elapsed.as_secs());
@@ -780,6 +1046,10 @@ impl super::Handler for HttpHandler {
 
         Ok(program)
     }
+
+    fn get_default_temperature(&self) -> f32 {
+        DEFAULT_TEMPERATURE
+    }
 }
 
 #[cfg(test)]
@@ -809,6 +1079,7 @@ mod tests {
             presence_penalty: None,
             stop: None,
             stream: Some(false),
+            stream_options: None,
         };
 
         assert!(client.validate_openai_request(&valid_request).is_ok());
@@ -824,6 +1095,7 @@ mod tests {
             presence_penalty: None,
             stop: None,
             stream: Some(false),
+            stream_options: None,
         };
 
         assert!(client.validate_openai_request(&invalid_request).is_err());
@@ -895,4 +1167,19 @@ mod tests {
         env::remove_var("OPENAI_API_KEY");
         env::remove_var("OPENAI_MODEL_NAME");
     }
+
+    #[test]
+    fn test_cached_tokens() {
+        let vllm: OpenAIUsage = serde_json::from_str(
+            r#"{"prompt_tokens": 100, "completion_tokens": 20, "total_tokens": 120,
+            "prompt_tokens_details": {"cached_tokens": 64}}"#,
+        )
+        .unwrap();
+        assert_eq!(TokenUsage::from_openai_usage(&vllm).cached_tokens, 64);
+        let plain: OpenAIUsage = serde_json::from_str(
+            r#"{"prompt_tokens": 100, "completion_tokens": 20, "total_tokens": 120}"#,
+        )
+        .unwrap();
+        assert_eq!(plain.get_cached_tokens(), 0);
+    }
 }
@@ -1,15 +1,142 @@
-use crate::program::Program;
+use std::{
+    future::Future,
+    sync::{
+        atomic::{AtomicU64, Ordering},
+        mpsc::{Receiver, Sender},
+    },
+    time::Duration,
+};
 
-use self::prompt::Prompt;
+use once_cell::sync::OnceCell;
+use tokio::sync::{Semaphore, SemaphorePermit};
 
+use crate::{config::get_config, program::Program};
+
+use self::{http::TokenUsage, prompt::Prompt};
+
+pub mod cache;
 pub mod http;
 pub mod openai;
 pub mod prompt;
+pub mod stream;
+
+/// The programs of a request, each of which is sent once its completion arrives.
+pub type ProgramStream = Receiver<eyre::Result<Program>>;
 
-pub trait Handler {
+/// Handlers are shared by the concurrent generation lanes.
+pub trait Handler: Send + Sync {
     /// generate programs via a formatted prompt
     fn generate(&self, prompt: &Prompt) -> eyre::Result<Vec<Program>>;
+
+    /// generate programs without blocking, each program is streamed once its completion arrives.
+    fn generate_stream(&self, prompt: &Prompt) -> eyre::Result<ProgramStream>;
     
     /// generate a single program (used for CoT Phase 1: plan generation)
     fn generate_single(&self, prompt: &Prompt) -> eyre::Result<Program>;
+
+    /// The temperature of the requests whose prompt does not set one.
+    fn get_default_temperature(&self) -> f32;
+}
+
+/// The runtime shared by all LLM requests of the process.
+pub fn get_runtime() -> &'static tokio::runtime::Runtime {
+    static RUNTIME: OnceCell<tokio::runtime::Runtime> = OnceCell::new();
+    RUNTIME.get_or_init(|| {
+        tokio::runtime::Builder::new_multi_thread()
+            .enable_all()
+            .thread_name("llm-request")
+            .build()
+            .unwrap_or_else(|_| panic!("Unable to build the LLM request runtime."))
+    })
+}
+
+/// The connect timeout of the shared HTTP client.
+pub const DEFAULT_CONNECT_TIMEOUT: Duration = Duration::from_secs(10);
+
+/// The HTTP client shared by all handlers, which pools the keep-alive connections.
+pub fn get_http_client() -> &'static reqwest::Client {
+    static HTTP_CLIENT: OnceCell<reqwest::Client> = OnceCell::new();
+    HTTP_CLIENT.get_or_init(|| {
+        build_http_client(DEFAULT_CONNECT_TIMEOUT)
+            .unwrap_or_else(|_| panic!("Unable to build the LLM HTTP client."))
+    })
+}
+
+/// Build an HTTP client with its own connection pool.
+pub fn build_http_client(connect_timeout: Duration) -> reqwest::Result<reqwest::Client> {
+    reqwest::ClientBuilder::new()
+        .connect_timeout(connect_timeout)
+        .timeout(Duration::from_secs(180))
+        .pool_idle_timeout(Duration::from_secs(90))
+        .tcp_keepalive(Duration::from_secs(60))
+        .http2_keep_alive_interval(Duration::from_secs(30))
+        .http2_keep_alive_while_idle(true)
+        .build()
+}
+
+/// Wait until the number of requests in flight is below `llm_concurrency`.
+pub async fn acquire_request_permit() -> SemaphorePermit<'static> {
+    static LIMITER: OnceCell<Semaphore> = OnceCell::new();
+    LIMITER
+        .get_or_init(|| Semaphore::new(get_config().llm_concurrency.max(1)))
+        .acquire()
+        .await
+        .expect("the request limiter is never closed")
+}
+
+/// Spawn the completions of a request on the shared runtime, and stream each program once its
+/// completion arrives. `handler` names the handler in the logs.
+pub fn spawn_program_stream<F>(completions: Vec<F>, handler: &'static str) -> ProgramStream
+where
+    F: Future<Output = eyre::Result<(Program, TokenUsage)>> + Send + 'static,
+{
+    let (sender, receiver) = std::sync::mpsc::channel();
+    let complete = move |completion: F, sender: Sender<eyre::Result<Program>>| async move {
+        let result = completion.await.map(|(program, usage)| {
+            log::debug!(
+                "{handler} Token Usage - Completion: {}",
+                usage.completion_tokens
+            );
+            program
+        });
+        // the receiver could have stopped on an error of another completion.
+        let _ = sender.send(result);
+    };
+    // a replay serves the completions in their recorded order, which involves no network.
+    if cache::get_cache_mode() == cache::CacheMode::Replay {
+        get_runtime().spawn(async move {
+            for completion in completions {
+                complete(completion, sender.clone()).await;
+            }
+        });
+        return receiver;
+    }
+    for completion in completions {
+        get_runtime().spawn(complete(completion, sender.clone()));
+    }
+    receiver
+}
+
+static COMPLETIONS: AtomicU64 = AtomicU64::new(0);
+static COMPLETION_TOKENS: AtomicU64 = AtomicU64::new(0);
+
+/// Count the output tokens of a completion, which are what the requests are paid for.
+pub fn record_completion_tokens(tokens: u32) {
+    COMPLETIONS.fetch_add(1, Ordering::Relaxed);
+    COMPLETION_TOKENS.fetch_add(tokens as u64, Ordering::Relaxed);
+}
+
+/// The output tokens of all completions so far.
+pub fn get_completion_tokens() -> u64 {
+    COMPLETION_TOKENS.load(Ordering::Relaxed)
+}
+
+/// The mean of output tokens per completion, or None before any completion with usage.
+pub fn get_mean_completion_tokens() -> Option<f32> {
+    let completions = COMPLETIONS.load(Ordering::Relaxed);
+    let tokens = COMPLETION_TOKENS.load(Ordering::Relaxed);
+    if completions == 0 || tokens == 0 {
+        return None;
+    }
+    Some(tokens as f32 / completions as f32)
 }
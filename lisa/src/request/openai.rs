@@ -1,7 +1,7 @@
-use std::{process::Child, time::Duration};
+use std::process::Child;
 
 use crate::{
-    config::{self, get_config, get_openai_proxy},
+    config::{self, get_openai_proxy},
     is_critical_err,
     program::Program,
     FuzzerError,
@@ -18,57 +18,33 @@ use eyre::Result;
 use futures::future::join_all;
 use once_cell::sync::OnceCell;
 
-use super::Handler;
+use super::{
+    acquire_request_permit,
+    cache::{self, CacheKey},
+    get_http_client, get_runtime,
+    http::HttpClient,
+    spawn_program_stream, Handler, ProgramStream,
+};
 
-/// Token使用统计结构
-#[derive(Debug, Clone, Default)]
-pub struct TokenUsage {
-    pub prompt_tokens: u32,
-    pub completion_tokens: u32,
-    pub total_tokens: u32,
-}
+pub use super::http::TokenUsage;
 
 impl TokenUsage {
-    pub fn new(prompt_tokens: u32, completion_tokens: u32, total_tokens: u32) -> Self {
-        Self {
-            prompt_tokens,
-            completion_tokens,
-            total_tokens,
-        }
-    }
-
     pub fn from_response(response: &CreateChatCompletionResponse) -> Self {
         if let Some(usage) = &response.usage {
-            Self {
-                prompt_tokens: usage.prompt_tokens,
-                completion_tokens: usage.completion_tokens,
-                total_tokens: usage.total_tokens,
-            }
+            Self::new(
+                usage.prompt_tokens,
+                usage.completion_tokens,
+                usage.total_tokens,
+            )
         } else {
             Self::default()
         }
     }
-
-    pub fn add(&mut self, other: &TokenUsage) {
-        self.prompt_tokens += other.prompt_tokens;
-        self.completion_tokens += other.completion_tokens;
-        self.total_tokens += other.total_tokens;
-    }
 }
 
+#[derive(Default)]
 pub struct OpenAIHanler {
     _child: Option<Child>,
-    rt: tokio::runtime::Runtime,
-}
-
-impl Default for OpenAIHanler {
-    fn default() -> Self {
-        let rt = tokio::runtime::Builder::new_current_thread()
-            .enable_all()
-            .build()
-            .unwrap_or_else(|_| panic!("Unable to build the openai runtime."));
-        Self { _child: None, rt }
-    }
 }
 
 impl Handler for OpenAIHanler {
@@ -77,11 +53,12 @@ impl Handler for OpenAIHanler {
         let start = std::time::Instant::now();
         let chat_msgs = prompt.to_chatgpt_message();
         let mut futures = Vec::new();
-        for _ in 0..get_config().n_sample {
-            let future = generate_program_by_chat(chat_msgs.clone());
+        let (n_sample, temperature) = (prompt.n_sample, prompt.temperature);
+        for _ in 0..n_sample {
+            let future = generate_program_by_chat(chat_msgs.clone(), n_sample, temperature);
             futures.push(future);
         }
-        let results = self.rt.block_on(join_all(futures));
+        let results = get_runtime().block_on(join_all(futures));
 
         let mut programs = Vec::new();
         let mut total_usage = TokenUsage::default();
@@ -104,11 +81,21 @@ impl Handler for OpenAIHanler {
         Ok(programs)
     }
 
+    fn generate_stream(&self, prompt: &super::prompt::Prompt) -> eyre::Result<ProgramStream> {
+        let chat_msgs = prompt.to_chatgpt_message();
+        let (n_sample, temperature) = (prompt.n_sample, prompt.temperature);
+        let completions = (0..n_sample)
+            .map(|_| generate_program_by_chat(chat_msgs.clone(), n_sample, temperature))
+            .collect();
+        Ok(spawn_program_stream(completions, "OpenAI"))
+    }
+
     /// Generate a single program (used for CoT Phase 1: plan generation)
     fn generate_single(&self, prompt: &super::prompt::Prompt) -> eyre::Result<Program> {
         let start = std::time::Instant::now();
         let chat_msgs = prompt.to_chatgpt_message();
-        let result = self.rt.block_on(generate_program_by_chat(chat_msgs));
+        let result =
+            get_runtime().block_on(generate_program_by_chat(chat_msgs, 1, prompt.temperature));
         
         let (program, usage) = result?;
         
@@ -123,6 +110,10 @@ impl Handler for OpenAIHanler {
 
         Ok(program)
     }
+
+    fn get_default_temperature(&self) -> f32 {
+        config::get_config().temperature
+    }
 }
 
 /// Get the OpenAI interface client.
@@ -130,11 +121,6 @@ fn get_client() -> Result<&'static Client<OpenAIConfig>> {
     // read OpenAI API key form the env var (OPENAI_API_KEY).
     pub static CLIENT: OnceCell<Client<OpenAIConfig>> = OnceCell::new();
     let client = CLIENT.get_or_init(|| {
-        let http_client = reqwest::ClientBuilder::new()
-            .connect_timeout(Duration::from_secs(10))
-            .timeout(Duration::from_secs(180))
-            .build()
-            .unwrap();
         let openai_config = if let Some(proxy) = get_openai_proxy() {
             log::debug!("Using OpenAI proxy: {}", proxy);
             OpenAIConfig::default().with_api_base(proxy)
@@ -142,23 +128,23 @@ fn get_client() -> Result<&'static Client<OpenAIConfig>> {
             OpenAIConfig::new()
         };
         let client = Client::with_config(openai_config);
-        let client = client.with_http_client(http_client);
+        let client = client.with_http_client(get_http_client().clone());
         client
     });
     Ok(client)
 }
 
-/// Create a request for a chat prompt
+/// Create a request for a chat prompt, sampled at the configured temperature if None.
 fn create_chat_request(
     msgs: Vec<ChatCompletionRequestMessage>,
     stop: Option<String>,
+    temperature: Option<f32>,
 ) -> Result<CreateChatCompletionRequest> {
     let mut binding = CreateChatCompletionRequestArgs::default();
     let binding = binding.model(config::get_openai_model_name());
 
-    let mut request = binding
-        .messages(msgs)
-        .temperature(config::get_config().temperature);
+    let temperature = temperature.unwrap_or_else(|| config::get_config().temperature);
+    let mut request = binding.messages(msgs).temperature(temperature);
     if let Some(stop) = stop {
         request = request.stop(stop);
     }
@@ -172,11 +158,15 @@ async fn get_chat_response(
 ) -> Result<CreateChatCompletionResponse> {
     let client = get_client().unwrap();
     for _retry in 0..config::RETRY_N {
-        let response = client
-            .chat()
-            .create(request.clone())
-            .await
-            .map_err(eyre::Report::new);
+        // the permit is taken per attempt, so a retry waits for its turn again.
+        let response = {
+            let _permit = acquire_request_permit().await;
+            client
+                .chat()
+                .create(request.clone())
+                .await
+                .map_err(eyre::Report::new)
+        };
         match is_critical_err(&response) {
             crate::Critical::Normal => {
                 let response = response?;
@@ -191,10 +181,22 @@ async fn get_chat_response(
     Err(FuzzerError::RetryError(format!("{request:?}"), config::RETRY_N).into())
 }
 
+/// Generate a program as one of the `n` samples of the messages.
 pub async fn generate_program_by_chat(
     chat_msgs: Vec<ChatCompletionRequestMessage>,
+    n: u8,
+    temperature: Option<f32>,
 ) -> Result<(Program, TokenUsage)> {
-    let request = create_chat_request(chat_msgs, None)?;
+    let messages: Vec<_> = chat_msgs
+        .iter()
+        .map(HttpClient::convert_chat_message)
+        .collect();
+    let request = create_chat_request(chat_msgs, None, temperature)?;
+    let key = CacheKey::new(&request.model, request.temperature, n, &messages);
+    cache::complete(key, request_program(request)).await
+}
+
+async fn request_program(request: CreateChatCompletionRequest) -> Result<(Program, TokenUsage)> {
     let respond = get_chat_response(request).await?;
 
     let usage = TokenUsage::from_response(&respond);
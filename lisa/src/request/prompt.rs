@@ -7,7 +7,7 @@ use async_openai::types::{
 use once_cell::sync::OnceCell;
 use std::collections::VecDeque;
 use std::{
-    collections::{HashMap, HashSet},
+    collections::{BTreeSet, HashMap, HashSet},
     fmt::Display,
     path::PathBuf,
     sync::RwLock,
@@ -31,6 +31,10 @@ pub struct Prompt {
     pub gadgets: Vec<&'static FuncGadget>,
     pub successful_examples: VecDeque<String>,
     pub task: ProgramTask,
+    /// The number of programs sampled per request.
+    pub n_sample: u8,
+    /// The sampling temperature, or the default of the handler if None.
+    pub temperature: Option<f32>,
 }
 
 impl Prompt {
@@ -47,6 +51,8 @@ impl Prompt {
             gadgets,
             successful_examples: VecDeque::new(),
             task,
+            n_sample: config::get_config().n_sample,
+            temperature: None,
         }
     }
     
@@ -166,17 +172,34 @@ impl Prompt {
         &mut self.gadgets
     }
 
+    /// Format the successful examples, which are put at the end of user messages.
+    fn get_successful_examples(&self) -> String {
+        if self.successful_examples.is_empty() {
+            return String::new();
+        }
+        let examples_code = self
+            .successful_examples
+            .iter()
+            .cloned()
+            .collect::<Vec<String>>()
+            .join("\n\n---\n\n");
+        format!("Here are some successful examples:\n```cpp\n{examples_code}\n```")
+    }
+
     /// format to chat kind prompt.
+    /// The system message is the same for all prompts, and the parts varying with the
+    /// combination are appended to the end of the user message, to hit the prefix cache.
     pub fn to_chatgpt_message(&self) -> Vec<ChatCompletionRequestMessage> {
         let config = config::get_config();
-        let ctx = get_combination_definitions(&self.gadgets);
+        let ctx = get_combination_definitions(&self.gadgets, &config);
 
         if config.generation_mode == config::GenerationModeP::FuzzDriver {
             log::debug!("Using FuzzDriver generation mode");
-            let sys_msg = get_sys_gen_message(ctx, &config);
+            let sys_msg = get_sys_gen_message(&config);
             log::trace!("System role: {sys_msg}");
-            let user_msg = config::get_user_chat_template()
+            let mut user_msg = config::get_user_chat_template()
                 .replace("{combinations}", &combination_to_str(&self.gadgets));
+            user_msg.push_str(&ctx);
             let sys_msg = ChatCompletionRequestSystemMessageArgs::default()
                 .content(sys_msg)
                 .build()
@@ -190,64 +213,29 @@ impl Prompt {
             vec![sys_msg, user_msg]
         } else {
             log::debug!("Using ApiCombination generation mode");
-            let sys_msg = get_sys_gen_message(ctx, &config);
+            let sys_msg = get_sys_gen_message(&config);
             // 也使用带上下文的消息
             let user_msg_content = match &self.task {
                 &ProgramTask::Generate => {
-                    let successful_examples = if !self.successful_examples.is_empty() {
-                        let examples_code = self
-                            .successful_examples
-                            .iter()
-                            .cloned()
-                            .collect::<Vec<String>>()
-                            .join("\n\n---\n\n");
-                        format!(
-                            "Here are some successful examples:\n```cpp\n{}\n```",
-                            examples_code
-                        )
-                    } else {
-                        String::new()
-                    };
-
+                    let tail = ctx + &self.get_successful_examples();
                     config::get_user_gen_template()
                         .replace("{combinations}", &combination_to_str(&self.gadgets))
-                        .replace("{successful_examples}", &successful_examples)
+                        .replace("{successful_examples}", &tail)
                 }
-                
+
                 ProgramTask::CotPlan => {
                     log::debug!("CoT Phase 1: Generating execution plan");
-    
-                    config::get_user_cot_plan_template()
-                        .replace("{combinations}", &combination_to_str(&self.gadgets))
-                       
-                       
+                    let mut user_msg = config::get_user_cot_plan_template()
+                        .replace("{combinations}", &combination_to_str(&self.gadgets));
+                    user_msg.push_str(&ctx);
+                    user_msg
                 }
-                
+
                 ProgramTask::CotCode { execution_plan } => {
                     log::debug!("CoT Phase 2: Generating code from plan");
-                    let successful_examples = if !self.successful_examples.is_empty() {
-                        let examples_code = self
-                            .successful_examples
-                            .iter()
-                            .cloned()
-                            .collect::<Vec<String>>()
-                            .join("\n\n---\n\n");
-                        format!(
-                            "Here are some successful examples:\n```cpp\n{}\n```",
-                            examples_code
-                        )
-                    } else {
-                        String::new()
-                    };
-                    
-                    let project_rules = config::get_raw_project_rules();
                     config::get_user_cot_code_template()
                         .replace("{execution_plan}", execution_plan)
-                        .replace("{project_rules}", &project_rules)
-                        .replace("{successful_examples}", &successful_examples)
-                    
-                    
-                    
+                        .replace("{successful_examples}", &self.get_successful_examples())
                 }
 
                 ProgramTask::Repair { failed_code, error } => {
@@ -286,32 +274,62 @@ impl Prompt {
     }
 }
 
+/// The library level context of the system message, and the types defined in it.
+struct LibraryContext {
+    message: String,
+    defined_tys: HashSet<String>,
+}
+
+/// Build the system message once. It is byte-identical across requests, thus the servers
+/// could reuse the prefix cache of it (e.g., the automatic prefix caching of vLLM).
+fn get_library_context(config: &Config) -> &'static LibraryContext {
+    static CONTEXT: OnceCell<LibraryContext> = OnceCell::new();
+    CONTEXT.get_or_init(|| {
+        let deopt = Deopt::new(get_library_name()).unwrap();
+        let mode = config.generation_mode.clone();
+        let mut template = match mode {
+            config::GenerationModeP::FuzzDriver => config::SYSTEM_GEN_TEMPLATE.to_string(),
+            config::GenerationModeP::ApiCombination => config::SYSTEM_API_TEMPLATE.to_string(),
+        };
+        let mut ctx_template =
+            config::SYSTEM_CONTEXT_TEMPLATE.replace("{project}", &get_library_name());
+        if let Some(desc) = &deopt.config.desc {
+            ctx_template.insert_str(0, desc);
+        }
+        let mut defined_tys = HashSet::new();
+        let ctx = get_type_definitions(get_context_func_gadgets(), &mut defined_tys);
+        let ctx_template = ctx_template.replace("{headers}", &get_include_sys_headers_str());
+        let ctx_template = ctx_template.replace("{APIs}", &dump_func_gadgets_tostr());
+        let ctx_template = ctx_template.replace("{context}", &ctx);
+        template.push_str("\n\n");
+        template.push_str(&ctx_template);
+        let project_rules = config::get_raw_project_rules();
+        if mode == config::GenerationModeP::ApiCombination
+            && !project_rules.contains("{project_rules}")
+        {
+            let rules_template = config::SYSTEM_RULES_TEMPLATE
+                .replace("{project}", &get_library_name())
+                .replace("{project_rules}", project_rules.trim_end());
+            template.push_str(&rules_template);
+        }
+        LibraryContext {
+            message: template,
+            defined_tys,
+        }
+    })
+}
+
 /// get the message of the system role for generative tasks.
-pub fn get_sys_gen_message(ctx: String, config: &Config) -> String {
-    let deopt = Deopt::new(get_library_name()).unwrap();
-    let mode = config.generation_mode.clone();
-    let mut template = match mode {
-        config::GenerationModeP::FuzzDriver => config::SYSTEM_GEN_TEMPLATE.to_string(),
-        config::GenerationModeP::ApiCombination => config::SYSTEM_API_TEMPLATE.to_string(),
-    };
-    let mut ctx_template =
-        config::SYSTEM_CONTEXT_TEMPLATE.replace("{project}", &get_library_name());
-    if let Some(desc) = deopt.config.desc {
-        ctx_template.insert_str(0, &desc);
-    }
-    let ctx_template = ctx_template.replace("{headers}", &get_include_sys_headers_str());
-    let ctx_template = ctx_template.replace("{APIs}", &dump_func_gadgets_tostr());
-    let ctx_template = ctx_template.replace("{context}", &ctx);
-    template.push_str("\n\n");
-    template.push_str(&ctx_template);
-    template
+pub fn get_sys_gen_message(config: &Config) -> &'static str {
+    &get_library_context(config).message
 }
 
-/// get the type definitions in args of the apis of the combination.
-fn get_combination_definitions(combination: &Vec<&FuncGadget>) -> String {
+/// get the type definitions in args and returns of the apis, skipping the `visited` types.
+/// The types are sorted to make the definitions in the same order across runs.
+fn get_type_definitions(funcs: &[&FuncGadget], visited: &mut HashSet<String>) -> String {
     let mut context = Vec::new();
-    let mut unique_tys = HashSet::new();
-    for func in combination {
+    let mut unique_tys = BTreeSet::new();
+    for func in funcs {
         for arg in func.get_alias_arg_types() {
             unique_tys.insert(get_unsugared_unqualified_type(arg));
         }
@@ -325,15 +343,24 @@ fn get_combination_definitions(combination: &Vec<&FuncGadget>) -> String {
         }
     }
 
-    let mut visited: HashSet<String> = HashSet::new();
     for ty in unique_tys {
-        if let Some(def) = get_type_definition(&ty, &mut visited) {
+        if let Some(def) = get_type_definition(&ty, visited) {
             context.push(def);
         }
     }
     context.join("\n\n")
 }
 
+/// get the definitions of the types used by the combination but absent in the system message.
+fn get_combination_definitions(combination: &[&FuncGadget], config: &Config) -> String {
+    let mut visited = get_library_context(config).defined_tys.clone();
+    let ctx = get_type_definitions(combination, &mut visited);
+    if ctx.is_empty() {
+        return ctx;
+    }
+    format!("\nHere are the other custom types used by the above APIs:\n```cpp\n{ctx}\n```\n")
+}
+
 pub fn combination_to_str(combination: &Vec<&FuncGadget>) -> String {
     let mut signatures = Vec::new();
     for func in combination {
@@ -376,8 +403,9 @@ use crate::{
     deopt::Deopt,
     program::{
         gadget::{
-            ctype::get_unsugared_unqualified_type, dump_func_gadgets_tostr, get_func_gadget,
-            typed_gadget::get_type_definition, FuncGadget,
+            ctype::get_unsugared_unqualified_type, dump_func_gadgets_tostr,
+            get_context_func_gadgets, get_func_gadget, typed_gadget::get_type_definition,
+            FuncGadget,
         },
         serde::Serialize,
     },
@@ -0,0 +1,258 @@
+//! Early rejection of the completions streamed from LLMs. The partial code is parsed incrementally at
+//! line boundaries, and a completion is cancelled once it leaves the code block, exceeds `MAX_TOKENS`,
+//! or calls an API of this library that does not exist.
+use std::collections::{HashMap, HashSet};
+
+use once_cell::sync::OnceCell;
+use regex::Regex;
+use tree_sitter::{InputEdit, Parser, Point, Query, QueryCursor, Tree};
+
+use crate::{
+    analysis::calls::new_cpp_parser,
+    config::{self, MAX_TOKENS},
+    deopt::{utils::read_all_files_in_dir, Deopt},
+    program::gadget::get_func_gadgets,
+};
+
+pub enum StreamVerdict {
+    /// keep receiving the completion.
+    Continue,
+    /// the code block is closed, the rest is prose.
+    Complete,
+    /// the completion would be thrown away by the sanitization.
+    Reject(String),
+}
+
+/// A prefix shared by at least this number of APIs is considered as a namespace of the library.
+const MIN_PREFIX_APIS: usize = 3;
+
+/// The namespace prefixes of the library APIs, e.g., `cJSON_` and `png_`.
+fn get_library_prefixes() -> &'static Vec<String> {
+    static PREFIXES: OnceCell<Vec<String>> = OnceCell::new();
+    PREFIXES.get_or_init(|| {
+        let mut counts: HashMap<&str, usize> = HashMap::new();
+        for gadget in get_func_gadgets() {
+            let name = gadget.get_func_name();
+            if let Some(idx) = name.find('_') {
+                if idx > 0 {
+                    *counts.entry(&name[..=idx]).or_default() += 1;
+                }
+            }
+        }
+        counts
+            .into_iter()
+            .filter(|(_, count)| *count >= MIN_PREFIX_APIS)
+            .map(|(prefix, _)| prefix.to_string())
+            .collect()
+    })
+}
+
+/// The identifiers in the library headers, which cover the function-like macros besides the gadgets.
+fn get_library_symbols() -> &'static HashSet<String> {
+    static SYMBOLS: OnceCell<HashSet<String>> = OnceCell::new();
+    SYMBOLS.get_or_init(|| {
+        let mut symbols: HashSet<String> = get_func_gadgets()
+            .iter()
+            .map(|x| x.get_func_name().to_string())
+            .collect();
+        let ident = Regex::new(r"[A-Za-z_][A-Za-z0-9_]*").unwrap();
+        let deopt = Deopt::new(config::get_library_name()).unwrap();
+        let headers = deopt
+            .get_library_build_header_path()
+            .and_then(|dir| read_all_files_in_dir(&dir))
+            .unwrap_or_default();
+        for header in headers {
+            if let Ok(content) = std::fs::read_to_string(&header) {
+                symbols.extend(ident.find_iter(&content).map(|x| x.as_str().to_string()));
+            }
+        }
+        symbols
+    })
+}
+
+fn get_symbol_query() -> &'static Query {
+    static SYMBOL_QUERY: OnceCell<Query> = OnceCell::new();
+    SYMBOL_QUERY.get_or_init(|| {
+        Query::new(
+            tree_sitter_cpp::language(),
+            r#"
+            (call_expression function: (identifier) @callee)
+            (function_declarator declarator: (identifier) @decl)
+            (preproc_function_def name: (identifier) @decl)
+            "#,
+        )
+        .expect("Failed to compile the symbol query")
+    })
+}
+
+/// Check a completion while it is streamed. The system functions never carry the prefixes of the
+/// library, thus only the calls with the prefixes are checked against the library symbols.
+pub struct CompletionMonitor {
+    prefixes: &'static [String],
+    symbols: &'static HashSet<String>,
+    parser: Parser,
+    tree: Option<Tree>,
+    /// The offset of the code in the completion, i.e., after the opening fence.
+    code_start: Option<usize>,
+    /// The bytes and the rows of the code parsed, which always ends at a line boundary.
+    parsed_len: usize,
+    parsed_rows: usize,
+    /// The functions and macros declared in the code parsed.
+    declared: HashSet<String>,
+    tokens: usize,
+}
+
+impl CompletionMonitor {
+    pub fn new(prefixes: &'static [String], symbols: &'static HashSet<String>) -> Self {
+        Self {
+            prefixes,
+            symbols,
+            parser: new_cpp_parser(),
+            tree: None,
+            code_start: None,
+            parsed_len: 0,
+            parsed_rows: 0,
+            declared: HashSet::new(),
+            tokens: 0,
+        }
+    }
+
+    pub fn for_library() -> Self {
+        Self::new(get_library_prefixes(), get_library_symbols())
+    }
+
+    /// Check the content received so far, with the number of tokens received since the last check.
+    pub fn check(&mut self, content: &str, new_tokens: usize) -> StreamVerdict {
+        self.tokens += new_tokens;
+        if self.tokens > MAX_TOKENS as usize {
+            return StreamVerdict::Reject(format!("exceeds {MAX_TOKENS} tokens"));
+        }
+        let code_start = match self.code_start {
+            Some(code_start) => code_start,
+            None => {
+                let Some(fence) = content.find("```") else {
+                    return StreamVerdict::Continue;
+                };
+                let Some(line_end) = content[fence..].find('\n') else {
+                    return StreamVerdict::Continue;
+                };
+                self.code_start = Some(fence + line_end + 1);
+                fence + line_end + 1
+            }
+        };
+        let code = &content[code_start..];
+        if code.contains("```") {
+            return StreamVerdict::Complete;
+        }
+        // the last line could be an incomplete identifier.
+        let complete_len = code.rfind('\n').map_or(0, |x| x + 1);
+        if complete_len <= self.parsed_len {
+            return StreamVerdict::Continue;
+        }
+        let code = &code[..complete_len];
+        let checked_len = self.parsed_len;
+        self.parse_lines(code);
+        match self.find_unknown_call(code, checked_len) {
+            Some(callee) => StreamVerdict::Reject(format!("calls an unknown API {callee}")),
+            None => StreamVerdict::Continue,
+        }
+    }
+
+    /// Parse the lines appended since the last parse, reusing the old tree.
+    fn parse_lines(&mut self, code: &str) {
+        let rows = self.parsed_rows + code[self.parsed_len..].matches('\n').count();
+        if let Some(tree) = &mut self.tree {
+            tree.edit(&InputEdit {
+                start_byte: self.parsed_len,
+                old_end_byte: self.parsed_len,
+                new_end_byte: code.len(),
+                start_position: Point::new(self.parsed_rows, 0),
+                old_end_position: Point::new(self.parsed_rows, 0),
+                new_end_position: Point::new(rows, 0),
+            });
+        }
+        self.tree = self.parser.parse(code, self.tree.as_ref());
+        self.parsed_len = code.len();
+        self.parsed_rows = rows;
+    }
+
+    /// Find a call with a library prefix that is neither a library symbol nor declared before.
+    /// Only the nodes reaching past `checked_len` are queried, as the earlier ones were checked
+    /// by the previous calls, whose declarations are kept in `declared`.
+    fn find_unknown_call<'a>(&mut self, code: &'a str, checked_len: usize) -> Option<&'a str> {
+        let tree = self.tree.as_ref()?;
+        let query = get_symbol_query();
+        let callee_idx = query.capture_index_for_name("callee")?;
+        let mut cursor = QueryCursor::new();
+        cursor.set_byte_range(checked_len..code.len());
+        for (m, i) in cursor.captures(query, tree.root_node(), code.as_bytes()) {
+            let capture = m.captures[i];
+            let Ok(name) = capture.node.utf8_text(code.as_bytes()) else {
+                continue;
+            };
+            if capture.index != callee_idx {
+                self.declared.insert(name.to_string());
+                continue;
+            }
+            if self.prefixes.iter().any(|x| name.starts_with(x.as_str()))
+                && !self.symbols.contains(name)
+                && !self.declared.contains(name)
+            {
+                return Some(name);
+            }
+        }
+        None
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn new_monitor() -> CompletionMonitor {
+        let prefixes = Box::leak(Box::new(vec!["cJSON_".to_string()]));
+        let symbols = Box::leak(Box::new(HashSet::from([
+            "cJSON_Parse".to_string(),
+            "cJSON_Delete".to_string(),
+        ])));
+        CompletionMonitor::new(prefixes, symbols)
+    }
+
+    fn feed(monitor: &mut CompletionMonitor, content: &mut String, chunk: &str) -> StreamVerdict {
+        content.push_str(chunk);
+        monitor.check(content, 1)
+    }
+
+    #[test]
+    fn test_completion_monitor() {
+        let mut monitor = new_monitor();
+        let mut content = String::new();
+        let chunks = [
+            "Here is the code:\n```cpp\n#include <cJSON.h>\n",
+            "static void cJSON_Helper(cJSON *json) {}\n",
+            "int main() {\n  cJSON *json = cJSON_Par",
+            "se(\"{}\");\n  cJSON_Helper(json);\n  printf(\"%p\", json);\n",
+            "  cJSON_Delete(json);\n",
+        ];
+        for chunk in chunks {
+            let verdict = feed(&mut monitor, &mut content, chunk);
+            assert!(matches!(verdict, StreamVerdict::Continue));
+        }
+        let verdict = feed(&mut monitor, &mut content, "  cJSON_Missing(json, 0);\n");
+        assert!(matches!(verdict, StreamVerdict::Reject(_)));
+
+        let mut monitor = new_monitor();
+        let mut content = String::new();
+        feed(
+            &mut monitor,
+            &mut content,
+            "```cpp\nint main() {\n  return 0;\n}\n",
+        );
+        let verdict = feed(&mut monitor, &mut content, "```\nThe program does nothing.");
+        assert!(matches!(verdict, StreamVerdict::Complete));
+
+        let mut monitor = new_monitor();
+        let verdict = monitor.check("```cpp\n", MAX_TOKENS as usize + 1);
+        assert!(matches!(verdict, StreamVerdict::Reject(_)));
+    }
+}